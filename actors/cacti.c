@@ -1,123 +1,1336 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
 
 #include "cacti.h"
 #include "data_structures.h"
 
-global_data_t global_data;
+// The system made by actor_system_create, used by the functions without a system handle
+// outside the working threads.
+_Atomic(global_data_t*) default_system = NULL;
 
-// Returns the index of the current thread in the map (implemented as two arrays of fixed size)
-// connecting thread IDs to the currently executed actors. The index is found by binary search.
-int current_thread_index(){
-    pthread_t* threads = global_data.thread_descriptors;
-    pthread_t current = pthread_self();
-    int l = 0;
-    int p = POOL_SIZE-1;
-    int s;
-    while(l < p){
-        s = (l+p) / 2;
-        if(threads[s] < current){
-            l = s+1;
+// The system and the slot of the current working thread, -1 in threads outside the pool.
+__thread global_data_t* thread_system = NULL;
+__thread int thread_index = -1;
+__thread actor_info* executed_actor = NULL;
+
+#if CACTI_METRICS
+// The metrics of the current working or blocking thread.
+__thread thread_metrics* own_metrics = NULL;
+
+// Only the owner writes its counters, so there is no need for a locked add.
+static inline void metric_add(atomic_ulong* counter, unsigned long value){
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static inline int metrics_bucket(uint64_t nsec){
+    int res = nsec == 0 ? 0 : 63 - __builtin_clzll(nsec);
+    return res < CACTI_METRICS_BUCKETS ? res : CACTI_METRICS_BUCKETS - 1;
+}
+
+static inline int metrics_prompt(message_type_t message_type){
+    return message_type >= 0 && message_type < CACTI_METRICS_PROMPTS ? (int) message_type : CACTI_METRICS_PROMPTS;
+}
+#endif
+
+#if CACTI_TRACE
+// The ring of the current working or blocking thread.
+__thread trace_ring* own_trace = NULL;
+
+void trace_write(trace_ring* ring, trace_kind kind, actor_id_t actor, actor_id_t other,
+                 message_type_t message_type, long value){
+    size_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->claimed, position + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    trace_event* event = &ring->events[position % CACTI_TRACE_EVENTS];
+    event->tsc = trace_clock();
+    event->actor = actor;
+    event->other = other;
+    event->message_type = message_type;
+    event->value = value;
+    event->kind = kind;
+    atomic_store_explicit(&ring->head, position + 1, memory_order_release);
+}
+
+// Records the event in the ring of the calling thread, or in the shared one if the thread
+// is not the system's. The actor is the one the thread is executing, if any.
+void trace(global_data_t* global_data, trace_kind kind, actor_id_t other, message_type_t message_type, long value){
+    if(thread_system == global_data && own_trace != NULL){
+        actor_id_t actor = executed_actor != NULL ? executed_actor->actor_id : -1;
+        trace_write(own_trace, kind, actor, other, message_type, value);
+        return;
+    }
+    pthread_mutex_lock(global_data->trace_mutex);
+    if(global_data->outside_trace == NULL) global_data->outside_trace = new_trace_ring(-1);
+    trace_write(global_data->outside_trace, kind, -1, other, message_type, value);
+    pthread_mutex_unlock(global_data->trace_mutex);
+}
+#endif
+
+// NULL outside the working threads if there is no default system.
+global_data_t* current_system(){
+    return thread_system != NULL ? thread_system : atomic_load(&default_system);
+}
+
+// Threads outside the system's threads using the default system, which is not freed until
+// they are done with it.
+atomic_long default_users = 0;
+
+// Like current_system, but the default system is held until leave_system is called.
+// A joining thread which clears it, and then sees no users, frees it safely: a thread
+// which counts itself in after that finds it gone.
+global_data_t* enter_system(){
+    if(thread_system != NULL) return thread_system;
+    atomic_fetch_add(&default_users, 1);
+    global_data_t* res = atomic_load(&default_system);
+    if(res == NULL) atomic_fetch_sub(&default_users, 1);
+    return res;
+}
+
+// Called after enter_system has returned a system.
+void leave_system(){
+    if(thread_system == NULL) atomic_fetch_sub(&default_users, 1);
+}
+
+// Returns the index of the current thread in the map connecting thread slots
+// to the currently executed actors, or -1 if it is not a working thread of the system.
+int current_thread_index(global_data_t* global_data){
+    return thread_system == global_data ? thread_index : -1;
+}
+
+void set_executed_actor(global_data_t* global_data, int index, actor_id_t ait){
+    global_data->thread_to_actor[index] = ait;
+}
+
+// Whether the actor's slot exists. The actor itself may be dead, or reclaimed already.
+bool actor_exists(global_data_t* global_data, actor_id_t ait){
+    return ait >= 0 && actor_slot(ait) < actors_directory_size(global_data->actors);
+}
+
+// A dead actor still executes the messages sent before its death, which may be many,
+// as GODIE skips the queue. It counts as alive until it is reclaimed, so that the system
+// does not finish before they are all executed.
+void kill_actor(actor_info* af){
+    atomic_store(&af->dead, true);
+}
+
+// May only be called by the working thread executing the actor.
+bool mailbox_empty(actor_info* current_actor){
+    return priority_lane_empty(&current_actor->priority) && bl_queue_empty(&current_actor->messages);
+}
+
+void* working_thread(void* start);
+
+void* blocking_thread(void* system);
+
+// Reads a number from a file of the CPU's sysfs directory, -1 if there is none.
+long read_cpu_attribute(int cpu, const char* name){
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    FILE* file = fopen(path, "r");
+    long res = -1;
+    if(file != NULL){
+        if(fscanf(file, "%ld", &res) != 1) res = -1;
+        fclose(file);
+    }
+    return res;
+}
+
+// The NUMA node of the CPU, -1 if it cannot be told.
+int cpu_node(int cpu){
+    char path[128];
+    for(int node = 0; node < AFFINITY_MAX_NODES; node++){
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if(access(path, F_OK) == 0) return node;
+    }
+    return -1;
+}
+
+// Lists the first online hardware thread of every physical core, in the order of CPU numbers.
+// Falls back to all online CPUs if the topology cannot be read.
+int* physical_cores(int* count){
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+    if(configured < 1) configured = 1;
+    if(configured > AFFINITY_MAX_CPUS) configured = AFFINITY_MAX_CPUS;
+    int* res = malloc(configured * sizeof(int));
+    long* cores = malloc(2 * configured * sizeof(long)); // the package and core IDs seen
+    *count = 0;
+    for(int cpu = 0; cpu < configured; cpu++){
+        long package = read_cpu_attribute(cpu, "topology/physical_package_id");
+        long core = read_cpu_attribute(cpu, "topology/core_id");
+        if(core < 0 || read_cpu_attribute(cpu, "online") == 0) continue;
+        bool seen = false;
+        for(int i = 0; i < *count && !seen; i++){
+            seen = cores[2 * i] == package && cores[2 * i + 1] == core;
         }
-        else if(threads[s] > current){
-            p = s;
+        if(seen) continue;
+        cores[2 * *count] = package;
+        cores[2 * *count + 1] = core;
+        res[(*count)++] = cpu;
+    }
+    free(cores);
+    if(*count == 0){
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for(int cpu = 0; cpu < online && cpu < configured; cpu++) res[(*count)++] = cpu;
+    }
+    return res;
+}
+
+// Decides the CPU of every thread slot, and finds the NUMA nodes they are on. Home nodes
+// only come into play if the threads span more than one node.
+void set_up_affinity(global_data_t* global_data){
+    const actor_system_config_t* config = &global_data->config;
+    int count = 0;
+    int* cpus = NULL;
+    if(config->affinity == CACTI_AFFINITY_CPUS){
+        count = config->ncpus;
+        cpus = malloc(count * sizeof(int));
+        memcpy(cpus, config->cpus, count * sizeof(int));
+    }
+    else if(config->affinity == CACTI_AFFINITY_CORES){
+        cpus = physical_cores(&count);
+    }
+    global_data->config.cpus = NULL;
+    if(count == 0){
+        free(cpus);
+        return;
+    }
+    global_data->worker_cpus = malloc(global_data->pool_capacity * sizeof(int));
+    int nodes = 0;
+    bool mixed = false;
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        global_data->worker_cpus[i] = cpus[i % count];
+        global_data->worker_nodes[i] = cpu_node(cpus[i % count]);
+        if(global_data->worker_nodes[i] >= nodes) nodes = global_data->worker_nodes[i] + 1;
+        mixed = mixed || global_data->worker_nodes[i] != global_data->worker_nodes[0];
+    }
+    free(cpus);
+    if(!mixed) return;
+    global_data->nodes = nodes;
+    global_data->node_queues = malloc(nodes * sizeof(message_queue*));
+    for(int i = 0; i < nodes; i++) global_data->node_queues[i] = new_message_queue();
+    for(int i = 0; i < global_data->pool_capacity; i++) global_data->slabs[i]->node = global_data->worker_nodes[i];
+}
+
+// Pins the calling thread to the CPU of its slot. The system call is made directly, as neither
+// pthread_setaffinity_np nor libnuma is available everywhere.
+void pin_thread(global_data_t* global_data, int slot){
+#ifdef SYS_sched_setaffinity
+    if(global_data->worker_cpus == NULL) return;
+    int cpu = global_data->worker_cpus[slot];
+    if(cpu < 0 || cpu >= AFFINITY_MAX_CPUS) return;
+    unsigned long mask[AFFINITY_MAX_CPUS / (8 * sizeof(unsigned long))] = {0};
+    mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0){
+        fprintf(stderr, "Warning: could not pin a working thread to CPU %d\n", cpu);
+    }
+#else
+    (void) global_data;
+    (void) slot;
+#endif
+}
+
+// Starts a new working thread in a free slot. Returns -1 if the pool is already at its limit
+// or the system is finishing, and pthread_create's error if it fails. Called with global_data->mutex held.
+int start_thread(global_data_t* global_data){
+    if(global_data->finished || atomic_load(&global_data->active_threads) >= global_data->config.max_workers){
+        return -1;
+    }
+    // A thread leaving the elastic pool keeps its slot for a moment after it stops being active.
+    int slot = 0;
+    while(slot < global_data->pool_capacity && atomic_load(&global_data->thread_slots[slot])) slot++;
+    if(slot == global_data->pool_capacity) return -1;
+    atomic_store(&global_data->thread_slots[slot], true);
+    atomic_fetch_add(&global_data->active_threads, 1);
+    global_data->running_threads += 1;
+    pthread_t thread;
+    worker_start* start = malloc(sizeof(worker_start));
+    start->global_data = global_data;
+    start->slot = slot;
+    int err = pthread_create(&thread, NULL, &working_thread, start);
+    if(err != 0){
+        free(start);
+        atomic_store(&global_data->thread_slots[slot], false);
+        atomic_fetch_sub(&global_data->active_threads, 1);
+        global_data->running_threads -= 1;
+        return err;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+// In the elastic mode, adds a thread when actors pile up and no thread is idle.
+// Only one thread is added at a time, further ones are added if the queues keep growing.
+void grow_pool(global_data_t* global_data){
+    if(atomic_load(&global_data->active_threads) >= global_data->config.max_workers ||
+            atomic_flag_test_and_set(&global_data->growing)){
+        return;
+    }
+    pthread_mutex_lock(global_data->mutex);
+    start_thread(global_data);
+    pthread_mutex_unlock(global_data->mutex);
+    atomic_flag_clear(&global_data->growing);
+}
+
+// In the elastic mode, lets a thread which has been idle for long enough exit,
+// as long as the pool does not shrink below its minimal size.
+bool shrink_pool(global_data_t* global_data){
+    int active = atomic_load(&global_data->active_threads);
+    while(active > global_data->config.min_workers){
+        if(atomic_compare_exchange_weak(&global_data->active_threads, &active, active - 1)){
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tells the CPU that the thread is spinning, so that it saves power and leaves the core
+// to its sibling hardware thread.
+static inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Sleeps as long as the word holds the expected value, for at most usec microseconds
+// if it is positive. Returns false on a timeout.
+bool futex_wait(atomic_uint* word, unsigned expected, long usec){
+    struct timespec timeout = {usec / 1000000, (usec % 1000000) * 1000};
+    long res = syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, usec > 0 ? &timeout : NULL, NULL, 0);
+    return res == 0 || errno != ETIMEDOUT;
+}
+
+void futex_wake(atomic_uint* word, int count){
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+// Wakes up parked working threads, if there are any, so that they can steal the actors
+// which have just been scheduled: one for a single actor, all of them for more.
+// Spinning threads find the actors by themselves, so as long as nobody is parked,
+// this costs no system call.
+void wake_idle_threads(global_data_t* global_data, size_t actors){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load(&global_data->parked_threads) > 0){
+        atomic_fetch_add(&global_data->idle_futex, 1);
+        futex_wake(&global_data->idle_futex, actors > 1 ? INT_MAX : 1);
+    }
+}
+
+// Makes the actors available for execution. A working thread keeps them in its own deque,
+// other threads (e.g. the one sending the first message) use the global queue.
+void schedule_here(global_data_t* global_data, const actor_id_t* aits, size_t count){
+    int index = current_thread_index(global_data);
+    long depth;
+    if(index < 0){
+        pthread_mutex_lock(global_data->message_q->mutex);
+        for(size_t i = 0; i < count; i++) message_queue_push(global_data->message_q, aits[i]);
+        depth = global_data->message_q->occupied;
+        pthread_mutex_unlock(global_data->message_q->mutex);
+    }
+    else{
+        for(size_t i = 0; i < count; i++) work_deque_push(global_data->deques[index], aits[i]);
+        depth = work_deque_size(global_data->deques[index]);
+    }
+    wake_idle_threads(global_data, count);
+    if(global_data->config.elastic && (size_t) depth >= global_data->config.grow_depth &&
+            atomic_load(&global_data->idle_threads) == 0){
+        grow_pool(global_data);
+    }
+}
+
+// Hands the actor to the queue of its home node, unless the current thread is on that node.
+// As the actor is being scheduled, its record cannot be reclaimed meanwhile.
+bool schedule_at_home(global_data_t* global_data, actor_id_t ait){
+    actor_info* ai = actors_directory_get(global_data->actors, ait);
+    if(ai == NULL || ai->home < 0) return false;
+    int index = current_thread_index(global_data);
+    if(index >= 0 && global_data->worker_nodes[index] == ai->home) return false;
+    message_queue* mq = global_data->node_queues[ai->home];
+    pthread_mutex_lock(mq->mutex);
+    message_queue_push(mq, ait);
+    pthread_mutex_unlock(mq->mutex);
+    return true;
+}
+
+void schedule_actors(global_data_t* global_data, const actor_id_t* aits, size_t count){
+    if(global_data->node_queues == NULL){
+        schedule_here(global_data, aits, count);
+        return;
+    }
+    size_t moved = 0;
+    for(size_t i = 0; i < count; i++){
+        if(schedule_at_home(global_data, aits[i])) moved += 1;
+        else schedule_here(global_data, &aits[i], 1);
+    }
+    if(moved > 0) wake_idle_threads(global_data, moved);
+}
+
+void schedule_actor(global_data_t* global_data, actor_id_t ait){
+    schedule_actors(global_data, &ait, 1);
+}
+
+// Schedules an actor which the executed prompt has just sent a message to, by putting it
+// in the thread's run-next slot. An actor there already, sent a message earlier by the same prompt, is moved
+// to the deque, where others may steal it. Nobody is woken up for the one left in the slot.
+void schedule_sent(global_data_t* global_data, actor_id_t ait){
+    int index = current_thread_index(global_data);
+    if(index < 0 || executed_actor == NULL || global_data->config.run_next_limit == 0){
+        schedule_actor(global_data, ait);
+        return;
+    }
+    if(global_data->node_queues != NULL && schedule_at_home(global_data, ait)){
+        wake_idle_threads(global_data, 1);
+        return;
+    }
+    run_next_slot* slot = &global_data->run_next[index];
+    actor_id_t previous = slot->actor;
+    slot->actor = ait;
+    if(previous != WORK_DEQUE_EMPTY) schedule_here(global_data, &previous, 1);
+}
+
+// Whether the actor's next message is for a blocking prompt. May only be called by the thread
+// executing the actor, on a non-empty mailbox.
+bool next_blocking(global_data_t* global_data, actor_info* current_actor){
+    int count = global_data->config.nblocking_prompts;
+    if(count == 0) return false;
+    role_t* role = current_actor->role;
+    priority_message* urgent = priority_lane_peek(&current_actor->priority);
+    message_type_t type = urgent != NULL ? urgent->message.message_type
+                                         : bl_queue_front_type(&current_actor->messages);
+    if(type < 0 || (size_t) type >= role->nprompts) return false;
+    for(int i = 0; i < count; i++){
+        if(global_data->config.blocking_prompts[i] == role->prompts[type]) return true;
+    }
+    return false;
+}
+
+// Starts a blocking thread. Called with the mutex of blocking_q held.
+void start_blocking_thread(global_data_t* global_data){
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, &blocking_thread, global_data) != 0){
+        fprintf(stderr, "Warning: could not start a blocking thread\n");
+        return;
+    }
+    pthread_detach(thread);
+    global_data->blocking_threads += 1;
+}
+
+// Hands the actor over to the blocking pool, which grows unless an idle thread is going to
+// take it. The actor stays marked as waiting meanwhile, so nobody else executes it.
+void dispatch_blocking(global_data_t* global_data, actor_info* current_actor){
+    message_queue* mq = global_data->blocking_q;
+    pthread_mutex_lock(mq->mutex);
+    message_queue_push(mq, current_actor->actor_id);
+    if(global_data->idle_blocking >= mq->occupied){
+        pthread_cond_signal(global_data->blocking_cond);
+    }
+    else if(global_data->blocking_threads < global_data->config.blocking_workers && !global_data->finished){
+        start_blocking_thread(global_data);
+    }
+    pthread_mutex_unlock(mq->mutex);
+}
+
+// Called after pushing a message to the actor's queue. If the actor is neither waiting for
+// execution nor being executed, the caller has to schedule it. It stays in that state until
+// a working thread finds its queue empty, so no two threads ever execute the same actor.
+bool join_queue(actor_info* current_actor){
+    atomic_thread_fence(memory_order_seq_cst);
+    return !atomic_exchange(&current_actor->waiting, true);
+}
+
+// Wakes up the director and the threads joining actors. With stop, the director
+// finishes the system.
+void notify_finish(global_data_t* global_data, bool stop){
+    pthread_mutex_lock(global_data->mutex);
+    if(stop) global_data->stopping = true;
+    pthread_cond_broadcast(global_data->finish_cond);
+    pthread_mutex_unlock(global_data->mutex);
+}
+
+// Working threads have actor slabs of their own, while threads outside the pool share the last
+// one under the global mutex.
+actor_slab* lock_slab(global_data_t* global_data){
+    int index = current_thread_index(global_data);
+    if(index >= 0) return global_data->slabs[index];
+    pthread_mutex_lock(global_data->mutex);
+    return global_data->slabs[global_data->pool_capacity];
+}
+
+void unlock_slab(global_data_t* global_data){
+    if(current_thread_index(global_data) < 0) pthread_mutex_unlock(global_data->mutex);
+}
+
+// Releases a dead actor with an empty queue and its slot. A sender which saw the actor alive
+// may still be pushing a message, which has to be executed first: then it returns false.
+// The last actor reclaimed stops the system, as nothing can happen in it any more.
+bool reclaim_actor(global_data_t* global_data, actor_info* current_actor){
+    while(atomic_load(&current_actor->senders) > 0) sched_yield();
+    if(!mailbox_empty(current_actor)) return false;
+    actors_directory_release(global_data->actors, current_actor->actor_id);
+    destroy_actor_info(current_actor);
+    actor_slab_free(lock_slab(global_data), current_actor);
+    unlock_slab(global_data);
+    bool last = atomic_fetch_sub(&global_data->alive_actors, 1) == 1;
+    atomic_thread_fence(memory_order_seq_cst);
+    if(last || atomic_load(&global_data->actor_joiners) > 0) notify_finish(global_data, last);
+    return true;
+}
+
+// Called by a working thread after executing a message of the given actor. A sender
+// may push a message right after the queue is found empty, but then either it sees
+// the actor as not waiting, or the check repeated here sees its message.
+// A dead actor stays scheduled until it is reclaimed, so nothing else executes it meanwhile.
+// An actor whose next message is for a blocking prompt goes to the blocking pool.
+void leave_actor(global_data_t* global_data, actor_info* current_actor){
+    if(mailbox_empty(current_actor)){
+        if(atomic_load(&current_actor->dead)){
+            if(reclaim_actor(global_data, current_actor)) return;
         }
         else{
-            return s;
+            bl_queue_shrink(&current_actor->messages);
+            atomic_store(&current_actor->waiting, false);
+            atomic_thread_fence(memory_order_seq_cst);
+            // The actor may be executed elsewhere by now, but its taken messages were none.
+            if((priority_lane_unpushed(&current_actor->priority) && bl_queue_unpushed(&current_actor->messages)) ||
+                    atomic_exchange(&current_actor->waiting, true)){
+                return;
+            }
         }
     }
-    return l;
+    if(!mailbox_empty(current_actor) && next_blocking(global_data, current_actor)){
+        dispatch_blocking(global_data, current_actor);
+    }
+    else{
+        schedule_actor(global_data, current_actor->actor_id);
+    }
 }
 
-void set_executed_actor(actor_id_t ait){
-    global_data.thread_to_actor[current_thread_index()] = ait;
+void cacti_system_set_throughput(global_data_t* global_data, size_t messages, long usec){
+    if(messages == 0) messages = 1;
+    if(usec < 0) usec = 0;
+    atomic_store(&global_data->throughput_messages, messages);
+    atomic_store(&global_data->throughput_usec, usec);
 }
 
-bool actor_exists(actor_id_t ait){
-    return ait < global_data.num_of_actors;
+void actor_system_set_throughput(size_t messages, long usec){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return;
+    cacti_system_set_throughput(global_data, messages, usec);
+    leave_system();
 }
 
-bool actor_dead(actor_id_t ait){
-    bool res = global_data.actors->actors[ait]->dead;
-    return res;
+bool is_system_message(message_type_t message_type){
+    return message_type == MSG_GODIE || message_type == MSG_SPAWN;
 }
 
-void set_waiting(actor_info* af, bool to_set){
-    pthread_mutex_lock(af->mutex);
-    af->waiting = to_set;
-    pthread_mutex_unlock(af->mutex);
+void push_priority(global_data_t* global_data, actor_info* current_actor, message_t message, payload_kind kind){
+    size_t nbytes = kind == MAILBOX_INLINE ? message.nbytes : 0;
+    priority_message* urgent = message_pool_alloc(global_data, current_thread_index(global_data),
+                                                  sizeof(priority_message) + nbytes);
+    if(kind == MAILBOX_INLINE){
+        if(nbytes > 0) memcpy(urgent->payload, message.data, nbytes);
+        message.data = urgent->payload;
+    }
+    urgent->message = message;
+    urgent->kind = kind;
+#if CACTI_METRICS
+    urgent->sent = metrics_clock();
+#endif
+    priority_lane_push(&current_actor->priority, urgent);
 }
 
-void kill_actor(actor_info* af){
-    pthread_mutex_lock(af->mutex);
-    af->dead = true;
-    pthread_mutex_unlock(af->mutex);
-    pthread_mutex_lock(global_data.mutex);
-    global_data.alive_actors -= 1;
-    pthread_mutex_unlock(global_data.mutex);
+// System messages go to the priority lane, and so do all the messages if priority is set.
+// The rest are pushed to the queue in runs, each with a single reservation. Stops at
+// the first message which does not fit, and returns the number of messages pushed.
+size_t push_to_mailbox(global_data_t* global_data, actor_info* current_actor, const message_t* messages, size_t count,
+                       payload_kind kind, bool priority){
+    size_t pushed = 0;
+    while(pushed < count){
+        if(priority || is_system_message(messages[pushed].message_type)){
+            push_priority(global_data, current_actor, messages[pushed], kind);
+            pushed += 1;
+            continue;
+        }
+        size_t run = 1;
+        while(pushed + run < count && !is_system_message(messages[pushed + run].message_type)) run++;
+        size_t res = bl_queue_push_many(&current_actor->messages, messages + pushed, run, kind);
+        pushed += res;
+        if(res < run) break;
+    }
+    return pushed;
 }
 
-// If an actor, whose message queue is not empty, is not present in the queue of actors waiting
-// for execution, it will join that queue here.
-void join_queue(actor_info* current_actor){
-    pthread_mutex_lock(global_data.message_q->mutex);
-    pthread_mutex_lock(current_actor->mutex);
-    if((!current_actor->waiting || message_queue_empty(global_data.message_q)) &&
-            !bl_queue_empty(current_actor->messages)){
-        current_actor->waiting = true;
-        message_queue_push(global_data.message_q, current_actor->actor_id);
-        pthread_cond_signal(global_data.message_q->actor_cond);
+// An ID of a reclaimed actor, even if its slot has been reused, refers to a dead actor.
+// Returns the number of messages pushed, or -1 or -2 like send_message, and tells whether
+// the actor has to be scheduled. However many messages there are, it is scheduled once.
+// If blocked_on is given and the queue is full, the caller is registered as a blocked sender
+// before trying once more, so that the actor usually sees the registration if it frees some
+// room after that try. If the try fails too, blocked_on is set to the actor.
+int push_messages(global_data_t* global_data, actor_id_t actor, const message_t* messages, size_t count,
+                  payload_kind kind, bool priority, bool* schedule, actor_info** blocked_on){
+    *schedule = false;
+#if CACTI_TRACE
+    message_type_t traced_type = count > 0 ? messages[0].message_type : -1;
+    trace(global_data, TRACE_SEND, actor, traced_type, (long) count);
+#endif
+    if(!actor_exists(global_data, actor)){
+        return -2;
+    }
+    actor_info* current_actor = actors_directory_get(global_data->actors, actor);
+    if(global_data->finished || current_actor == NULL){
+        return -1;
+    }
+    int res;
+    atomic_fetch_add(&current_actor->senders, 1);
+    if(current_actor->actor_id != actor || atomic_load(&current_actor->dead)){
+        res = -1;
     }
-    pthread_mutex_unlock(current_actor->mutex);
-    pthread_mutex_unlock(global_data.message_q->mutex);
+    else{
+        res = (int) push_to_mailbox(global_data, current_actor, messages, count, kind, priority);
+        if(res == 0 && blocked_on != NULL){
+            atomic_fetch_add(&current_actor->blocked_senders, 1);
+            res = (int) push_to_mailbox(global_data, current_actor, messages, count, kind, priority);
+            if(res == 0) *blocked_on = current_actor;
+            else atomic_fetch_sub(&current_actor->blocked_senders, 1);
+        }
+        if(res > 0) *schedule = join_queue(current_actor);
+    }
+    atomic_fetch_sub(&current_actor->senders, 1);
+#if CACTI_TRACE
+    trace(global_data, TRACE_ENQUEUE, actor, traced_type, res);
+#endif
+    return res;
+}
+
+int deliver_messages(global_data_t* global_data, actor_id_t actor, const message_t* messages, size_t count,
+                     payload_kind kind){
+    bool schedule;
+    int res = push_messages(global_data, actor, messages, count, kind, false, &schedule, NULL);
+    if(schedule) schedule_sent(global_data, actor);
+    return res;
+}
+
+int cacti_send_message(global_data_t* global_data, actor_id_t actor, message_t message){
+    int res = deliver_messages(global_data, actor, &message, 1, MAILBOX_POINTER);
+    if(res < 0) return res;
+    return res == 1 ? 0 : -3;
 }
 
 int send_message(actor_id_t actor, message_t message){
-    if(!actor_exists(actor)){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = cacti_send_message(global_data, actor, message);
+    leave_system();
+    return res;
+}
+
+int send_message_priority(actor_id_t actor, message_t message){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    bool schedule;
+    int res = push_messages(global_data, actor, &message, 1, MAILBOX_POINTER, true, &schedule, NULL);
+    if(schedule) schedule_sent(global_data, actor);
+    leave_system();
+    return res < 0 ? res : 0;
+}
+
+int send_messages(actor_id_t actor, message_t *messages, size_t count){
+    if(count > ACTOR_QUEUE_LIMIT) count = ACTOR_QUEUE_LIMIT;
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = deliver_messages(global_data, actor, messages, count, MAILBOX_POINTER);
+    leave_system();
+    return res;
+}
+
+// Returns the moment the given number of microseconds from now, for timed waits.
+struct timespec realtime_after(long usec){
+    struct timespec res;
+    clock_gettime(CLOCK_REALTIME, &res);
+    res.tv_sec += usec / 1000000;
+    res.tv_nsec += (usec % 1000000) * 1000;
+    if(res.tv_nsec >= 1000000000){
+        res.tv_sec += 1;
+        res.tv_nsec -= 1000000000;
+    }
+    return res;
+}
+
+// The same on CLOCK_MONOTONIC, for conditions made with new_monotonic_cond.
+struct timespec monotonic_after(long usec){
+    struct timespec res;
+    clock_gettime(CLOCK_MONOTONIC, &res);
+    res.tv_sec += usec / 1000000;
+    res.tv_nsec += (usec % 1000000) * 1000;
+    if(res.tv_nsec >= 1000000000){
+        res.tv_sec += 1;
+        res.tv_nsec -= 1000000000;
+    }
+    return res;
+}
+
+bool realtime_passed(const struct timespec* deadline){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// Wakes the senders waiting for room in the actor's queue, after it has popped some messages:
+// the threads outside the pool parked in send_message_wait, and the idle working threads
+// holding stalled actors. There is no fence here, as it would cost every activation, so
+// a sender registering just now may be missed. Senders never wait longer than
+// BACKPRESSURE_RETRY_USEC before checking again.
+void notify_blocked_senders(global_data_t* global_data, actor_info* current_actor){
+    if(atomic_load_explicit(&current_actor->blocked_senders, memory_order_relaxed) == 0) return;
+    pthread_mutex_lock(global_data->backpressure_mutex);
+    pthread_cond_broadcast(global_data->space_cond);
+    pthread_mutex_unlock(global_data->backpressure_mutex);
+    wake_idle_threads(global_data, (size_t) global_data->pool_capacity);
+}
+
+long microseconds_since(const struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Tick t is due once t ticks have passed since the start.
+uint64_t ticks_since(const struct timespec* start){
+    return microseconds_since(start) / TIMER_TICK_USEC;
+}
+
+// A timer fired by the timer thread, which sends its message after letting go of the wheel.
+// A one-shot timer keeps its entry, unarmed, until the message is sent.
+typedef struct{
+    timer_id_t id;
+    actor_id_t actor;
+    message_t message;
+    timer_entry* one_shot;
+} timer_firing;
+
+// Fires the timers due by now, and arms the periodic ones again.
+// Returns how many there are, and may replace the buffer with a larger one.
+size_t fire_timers(timer_wheel* tw, timer_firing** firings, size_t* capacity){
+    size_t res = 0;
+    uint64_t current = ticks_since(&tw->start);
+    while(tw->now <= current){
+        timer_entry* te = timer_wheel_advance(tw);
+        while(te != NULL){
+            timer_entry* next = te->next;
+            if(res == *capacity){
+                *capacity *= 2;
+                *firings = realloc(*firings, *capacity * sizeof(timer_firing));
+            }
+            (*firings)[res++] = (timer_firing) {te->id, te->actor, te->message, te->period > 0 ? NULL : te};
+            if(te->period > 0){
+                te->deadline += te->period;
+                timer_wheel_add(tw, te);
+            }
+            te = next;
+        }
+    }
+    return res;
+}
+
+int cancel_system_timer(global_data_t* global_data, timer_id_t timer){
+    timer_wheel* tw = global_data->timers;
+    pthread_mutex_lock(tw->mutex);
+    timer_entry* te = timer_wheel_find(tw, timer);
+    if(te != NULL){
+        timer_wheel_remove(tw, te);
+        timer_wheel_release(tw, te);
+    }
+    pthread_mutex_unlock(tw->mutex);
+    return te != NULL ? 0 : -1;
+}
+
+// Sends the messages of the fired timers. A one-shot timer whose actor's queue is full is
+// armed again for the next tick, while a periodic one skips the period.
+void send_fired(global_data_t* global_data, timer_firing* firings, size_t count){
+    timer_wheel* tw = global_data->timers;
+    for(size_t i = 0; i < count; i++){
+        int res = cacti_send_message(global_data, firings[i].actor, firings[i].message);
+        timer_entry* te = firings[i].one_shot;
+        if(te != NULL){
+            pthread_mutex_lock(tw->mutex);
+            if(res == -3 && !tw->stopping){
+                te->deadline = tw->now;
+                timer_wheel_add(tw, te);
+            }
+            else{
+                timer_wheel_release(tw, te);
+            }
+            pthread_mutex_unlock(tw->mutex);
+        }
+        else if(res == -3){
+            fprintf(stderr, "Warning: skipped a period of a timer whose receiver's queue was full\n");
+        }
+        else if(res < 0){
+            cancel_system_timer(global_data, firings[i].id);
+        }
+    }
+}
+
+// Services the system's timer wheel: sleeps until the next tick while some timers are armed,
+// or until one is added otherwise.
+void* timer_thread(void* system){
+    global_data_t* global_data = system;
+    timer_wheel* tw = global_data->timers;
+    size_t capacity = 16;
+    timer_firing* firings = malloc(capacity * sizeof(timer_firing));
+    pthread_mutex_lock(tw->mutex);
+    while(!tw->stopping){
+        if(tw->armed == 0){
+            pthread_cond_wait(tw->cond, tw->mutex);
+            continue;
+        }
+        size_t count = fire_timers(tw, &firings, &capacity);
+        if(count == 0){
+            // The thread may be running late, then the next tick is due at once.
+            int64_t delay = (int64_t) tw->now * TIMER_TICK_USEC - microseconds_since(&tw->start);
+            struct timespec deadline = monotonic_after(delay > 0 ? delay : 0);
+            pthread_cond_timedwait(tw->cond, tw->mutex, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(tw->mutex);
+        send_fired(global_data, firings, count);
+        pthread_mutex_lock(tw->mutex);
+    }
+    pthread_mutex_unlock(tw->mutex);
+    free(firings);
+    return NULL;
+}
+
+// Called by the director once the working threads are done.
+void stop_timer_thread(global_data_t* global_data){
+    timer_wheel* tw = global_data->timers;
+    pthread_mutex_lock(tw->mutex);
+    tw->stopping = true;
+    pthread_cond_signal(tw->cond);
+    pthread_mutex_unlock(tw->mutex);
+    if(tw->running) pthread_join(tw->thread, NULL);
+}
+
+uint64_t usec_to_ticks(int64_t usec){
+    if(usec < 0) usec = 0;
+    return ((uint64_t) usec + TIMER_TICK_USEC - 1) / TIMER_TICK_USEC;
+}
+
+timer_id_t start_timer(global_data_t* global_data, actor_id_t actor, message_t message, long delay_usec,
+                       long period_usec){
+    if(!actor_exists(global_data, actor)) return -2;
+    timer_wheel* tw = global_data->timers;
+    pthread_mutex_lock(tw->mutex);
+    if(tw->stopping || global_data->finished){
+        pthread_mutex_unlock(tw->mutex);
+        return -1;
+    }
+    if(!tw->running){
+        if(pthread_create(&tw->thread, NULL, &timer_thread, global_data) != 0){
+            pthread_mutex_unlock(tw->mutex);
+            fprintf(stderr, "Warning: could not start the timer thread\n");
+            return -1;
+        }
+        tw->running = true;
+    }
+    // With no timers armed, the thread does not go through the ticks, so they are skipped.
+    int64_t elapsed = microseconds_since(&tw->start);
+    uint64_t current = elapsed / TIMER_TICK_USEC;
+    if(tw->armed == 0 && tw->now < current) tw->now = current;
+    timer_entry* te = timer_wheel_acquire(tw);
+    te->actor = actor;
+    te->message = message;
+    te->deadline = usec_to_ticks(elapsed + (delay_usec > 0 ? delay_usec : 0));
+    te->period = period_usec > 0 ? usec_to_ticks(period_usec) : 0;
+    timer_wheel_add(tw, te);
+    timer_id_t res = te->id;
+    pthread_cond_signal(tw->cond);
+    pthread_mutex_unlock(tw->mutex);
+    return res;
+}
+
+timer_id_t send_message_after(actor_id_t actor, message_t message, long delay_usec){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    timer_id_t res = start_timer(global_data, actor, message, delay_usec, 0);
+    leave_system();
+    return res;
+}
+
+timer_id_t send_message_every(actor_id_t actor, message_t message, long delay_usec, long period_usec){
+    if(message.message_type == MSG_SPAWN) return -4;
+    if(period_usec < TIMER_TICK_USEC) period_usec = TIMER_TICK_USEC;
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    timer_id_t res = start_timer(global_data, actor, message, delay_usec, period_usec);
+    leave_system();
+    return res;
+}
+
+int cancel_timer(timer_id_t timer){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = cancel_system_timer(global_data, timer);
+    leave_system();
+    return res;
+}
+
+_Static_assert(sizeof(cacti_io_event_t) <= MESSAGE_INLINE_SIZE, "I/O events are sent inline");
+
+uint32_t io_to_epoll(int events){
+    uint32_t res = EPOLLONESHOT | EPOLLRDHUP;
+    if(events & CACTI_IO_READABLE) res |= EPOLLIN;
+    if(events & CACTI_IO_WRITABLE) res |= EPOLLOUT;
+    return res;
+}
+
+int epoll_to_io(uint32_t events){
+    int res = 0;
+    if(events & EPOLLIN) res |= CACTI_IO_READABLE;
+    if(events & EPOLLOUT) res |= CACTI_IO_WRITABLE;
+    if(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) res |= CACTI_IO_CLOSED;
+    return res;
+}
+
+// Drops the watch, and takes the descriptor out of epoll. Called with the reactor's mutex held.
+void forget_watch(io_reactor* r, int fd){
+    io_watch* w = &r->watches[fd];
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    if(w->pending != 0) r->pending -= 1;
+    w->pending = 0;
+    w->actor = -1;
+}
+
+// Sends the watch's pending events, unless the actor's queue is full. Called with the reactor's
+// mutex held, which is never held while sending otherwise, so a full queue blocks nothing.
+void send_io_event(global_data_t* global_data, io_reactor* r, int fd){
+    io_watch* w = &r->watches[fd];
+    cacti_io_event_t event = {fd, w->pending};
+    message_t message = new_message(w->message_type, sizeof(event), &event);
+    int res = deliver_messages(global_data, w->actor, &message, 1, MAILBOX_INLINE);
+    if(res == 0) return;
+    if(res < 0 || (event.events & CACTI_IO_CLOSED)){
+        forget_watch(r, fd);
+    }
+    else{
+        w->pending = 0;
+        r->pending -= 1;
+    }
+}
+
+// Waits for the watched descriptors, and sends their events. While some events wait for room in
+// their actors' queues, they are retried every BACKPRESSURE_RETRY_USEC.
+void* reactor_thread(void* system){
+    global_data_t* global_data = system;
+    io_reactor* r = global_data->reactor;
+    struct epoll_event events[REACTOR_EVENTS];
+    pthread_mutex_lock(r->mutex);
+    while(!r->stopping){
+        int timeout = r->pending > 0 ? (BACKPRESSURE_RETRY_USEC + 999) / 1000 : -1;
+        pthread_mutex_unlock(r->mutex);
+        int count = epoll_wait(r->epoll_fd, events, REACTOR_EVENTS, timeout);
+        pthread_mutex_lock(r->mutex);
+        for(int i = 0; i < count; i++){
+            int fd = events[i].data.fd;
+            // The descriptor may have been unwatched since, then its event is dropped.
+            if(fd == r->wake_fd || r->watches[fd].actor < 0) continue;
+            io_watch* w = &r->watches[fd];
+            if(w->pending == 0) r->pending += 1;
+            w->pending |= epoll_to_io(events[i].events);
+        }
+        for(int fd = 0; fd < r->capacity && r->pending > 0; fd++){
+            if(r->watches[fd].actor >= 0 && r->watches[fd].pending != 0) send_io_event(global_data, r, fd);
+        }
+    }
+    pthread_mutex_unlock(r->mutex);
+    return NULL;
+}
+
+// Called with the reactor's mutex held.
+bool start_reactor(global_data_t* global_data){
+    io_reactor* r = global_data->reactor;
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    r->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event wake = {EPOLLIN, {.fd = r->wake_fd}};
+    if(r->epoll_fd >= 0 && r->wake_fd >= 0 && epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &wake) == 0 &&
+            pthread_create(&r->thread, NULL, &reactor_thread, global_data) == 0){
+        r->running = true;
+        return true;
+    }
+    if(r->epoll_fd >= 0) close(r->epoll_fd);
+    if(r->wake_fd >= 0) close(r->wake_fd);
+    r->epoll_fd = -1;
+    r->wake_fd = -1;
+    fprintf(stderr, "Warning: could not start the reactor thread\n");
+    return false;
+}
+
+// Called by the director once the working threads are done.
+void stop_reactor(global_data_t* global_data){
+    io_reactor* r = global_data->reactor;
+    pthread_mutex_lock(r->mutex);
+    r->stopping = true;
+    if(r->running) eventfd_write(r->wake_fd, 1);
+    pthread_mutex_unlock(r->mutex);
+    if(r->running) pthread_join(r->thread, NULL);
+}
+
+// A descriptor closed without being unwatched has left epoll by itself, so it is added again.
+int watch_io(global_data_t* global_data, actor_id_t actor, int fd, int events, message_type_t message_type){
+    if(message_type == MSG_SPAWN || message_type == MSG_GODIE || fd < 0 ||
+            (events & (CACTI_IO_READABLE | CACTI_IO_WRITABLE)) == 0){
+        return -4;
+    }
+    if(!actor_exists(global_data, actor)) return -2;
+    io_reactor* r = global_data->reactor;
+    pthread_mutex_lock(r->mutex);
+    if(r->stopping || global_data->finished || (!r->running && !start_reactor(global_data))){
+        pthread_mutex_unlock(r->mutex);
+        return -1;
+    }
+    io_watch* w = reactor_watch(r, fd);
+    struct epoll_event event = {io_to_epoll(events), {.fd = fd}};
+    int err = epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    if(err != 0 && errno == ENOENT) err = epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if(err != 0){
+        if(w->actor >= 0) forget_watch(r, fd);
+        pthread_mutex_unlock(r->mutex);
+        return -4;
+    }
+    // Events not sent yet are dropped: if the descriptor is still ready, epoll reports it again.
+    if(w->pending != 0) r->pending -= 1;
+    w->pending = 0;
+    w->actor = actor;
+    w->message_type = message_type;
+    pthread_mutex_unlock(r->mutex);
+    return 0;
+}
+
+int unwatch_io(global_data_t* global_data, int fd){
+    io_reactor* r = global_data->reactor;
+    int res = -1;
+    pthread_mutex_lock(r->mutex);
+    if(fd >= 0 && fd < r->capacity && r->watches[fd].actor >= 0){
+        forget_watch(r, fd);
+        res = 0;
+    }
+    pthread_mutex_unlock(r->mutex);
+    return res;
+}
+
+int cacti_io_watch(actor_id_t actor, int fd, int events, message_type_t message_type){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = watch_io(global_data, actor, fd, events, message_type);
+    leave_system();
+    return res;
+}
+
+int cacti_io_unwatch(int fd){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = unwatch_io(global_data, fd);
+    leave_system();
+    return res;
+}
+
+// Parks a thread outside the pool until the message fits in the actor's queue,
+// or the deadline passes. Returns like send_message.
+int send_parked(global_data_t* global_data, actor_id_t actor, message_t message, const struct timespec* deadline){
+    int res;
+    pthread_mutex_lock(global_data->backpressure_mutex);
+    while(true){
+        actor_info* blocked_on = NULL;
+        bool schedule;
+        res = push_messages(global_data, actor, &message, 1, MAILBOX_POINTER, false, &schedule, &blocked_on);
+        if(schedule) schedule_actor(global_data, actor);
+        if(blocked_on == NULL) break;
+        if(!global_data->finished){
+            struct timespec retry = realtime_after(BACKPRESSURE_RETRY_USEC);
+            pthread_cond_timedwait(global_data->space_cond, global_data->backpressure_mutex, &retry);
+        }
+        atomic_fetch_sub(&blocked_on->blocked_senders, 1);
+        if(global_data->finished){
+            res = -1;
+            break;
+        }
+        if(deadline != NULL && realtime_passed(deadline)){
+            res = deliver_messages(global_data, actor, &message, 1, MAILBOX_POINTER);
+            break;
+        }
+    }
+    pthread_mutex_unlock(global_data->backpressure_mutex);
+    if(res < 0) return res;
+    return res == 1 ? 0 : -3;
+}
+
+// Queues the message after the actor's earlier deferred sends.
+int defer_send(global_data_t* global_data, actor_info* sender, actor_id_t actor, message_t message,
+               const struct timespec* deadline){
+    if(!actor_exists(global_data, actor)){
         return -2;
     }
-    if(global_data.finished || actor_dead(actor)){
+    actor_info* receiver_info = actors_directory_get(global_data->actors, actor);
+    if(receiver_info == NULL){
         return -1;
     }
-    actor_info* current_actor = global_data.actors->actors[actor];
-    bool sent = bl_queue_push(current_actor->messages, message);
-    if(!sent) return -3;
-    join_queue(current_actor);
+    deferred_send* deferred = malloc(sizeof(deferred_send));
+    deferred->next = NULL;
+    deferred->receiver = actor;
+    deferred->receiver_info = receiver_info;
+    deferred->message = message;
+    deferred->timed = deadline != NULL;
+    if(deadline != NULL) deferred->deadline = *deadline;
+    atomic_fetch_add(&receiver_info->blocked_senders, 1);
+    if(sender->stall == NULL){
+        sender->stall = malloc(sizeof(stall));
+        sender->stall->first = deferred;
+        sender->stall->next_stalled = NULL;
+    }
+    else{
+        sender->stall->last->next = deferred;
+    }
+    sender->stall->last = deferred;
+    return 0;
+}
+
+// Delivers as many of the actor's deferred sends as fit, in order. Returns whether
+// all of them are gone, then the actor is no longer stalled.
+bool flush_deferred(global_data_t* global_data, actor_info* current_actor){
+    stall* st = current_actor->stall;
+    while(st->first != NULL){
+        deferred_send* deferred = st->first;
+        bool schedule = false;
+        int res = -1;
+        if(deferred->timed && realtime_passed(&deferred->deadline)){
+            fprintf(stderr, "Warning: dropped a message which did not fit in its receiver's queue in time\n");
+        }
+        else{
+            res = push_messages(global_data, deferred->receiver, &deferred->message, 1, MAILBOX_POINTER, false,
+                                &schedule, NULL);
+            if(res == 0) return false;
+        }
+        if(schedule) schedule_actor(global_data, deferred->receiver);
+        atomic_fetch_sub(&deferred->receiver_info->blocked_senders, 1);
+        st->first = deferred->next;
+        free(deferred);
+    }
+    free(st);
+    current_actor->stall = NULL;
+    return true;
+}
+
+// Inside a prompt the working thread must not block, so a message which does not fit
+// is deferred. So is any message sent after one which is deferred already.
+int send_waiting(global_data_t* global_data, actor_id_t actor, message_t message, const struct timespec* deadline){
+    if(current_thread_index(global_data) < 0){
+        return send_parked(global_data, actor, message, deadline);
+    }
+    if(executed_actor->stall == NULL){
+        int res = cacti_send_message(global_data, actor, message);
+        if(res != -3) return res;
+    }
+    return defer_send(global_data, executed_actor, actor, message, deadline);
+}
+
+int send_message_wait(actor_id_t actor, message_t message){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    int res = send_waiting(global_data, actor, message, NULL);
+    leave_system();
+    return res;
+}
+
+int send_message_timed(actor_id_t actor, message_t message, long timeout_usec){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    struct timespec deadline = realtime_after(timeout_usec > 0 ? timeout_usec : 0);
+    int res = send_waiting(global_data, actor, message, &deadline);
+    leave_system();
+    return res;
+}
+
+int send_message_inline(actor_id_t actor, message_type_t message_type, const void *payload, size_t nbytes){
+    if(nbytes > MESSAGE_INLINE_SIZE || message_type == MSG_SPAWN){
+        return -4;
+    }
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return -2;
+    message_t message = new_message(message_type, nbytes, (void*) payload);
+    int res = deliver_messages(global_data, actor, &message, 1, MAILBOX_INLINE);
+    leave_system();
+    if(res < 0) return res;
+    return res == 1 ? 0 : -3;
+}
+
+void release_shared_payload(global_data_t* global_data, void* payload){
+    shared_payload* shared = (shared_payload*) payload - 1;
+    if(atomic_fetch_sub_explicit(&shared->references, 1, memory_order_acq_rel) == 1){
+        message_pool_free(global_data, current_thread_index(global_data), shared);
+    }
+}
+
+actor_group_t *cacti_group_create(global_data_t* global_data){
+    actor_group_t* res = new_actor_group();
+    res->system = global_data;
+    return res;
+}
+
+actor_group_t *actor_group_create(){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return NULL;
+    actor_group_t* res = cacti_group_create(global_data);
+    leave_system();
+    return res;
+}
+
+void actor_group_destroy(actor_group_t *group){
+    destroy_actor_group(group);
+}
+
+int actor_group_add(actor_group_t *group, actor_id_t actor){
+    if(!actor_exists(group->system, actor)){
+        return -2;
+    }
+    pthread_mutex_lock(&group->mutex);
+    actor_group_insert(group, actor);
+    pthread_mutex_unlock(&group->mutex);
     return 0;
 }
 
+int actor_group_remove(actor_group_t *group, actor_id_t actor){
+    int res = -1;
+    pthread_mutex_lock(&group->mutex);
+    for(size_t i = 0; i < group->count; i++){
+        if(group->members[i] == actor){
+            actor_group_erase(group, i);
+            res = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&group->mutex);
+    return res;
+}
+
+// Members found dead are removed, as their IDs never refer to a live actor again.
+// A member with a full queue stays, but misses the message.
+int send_to_group(actor_group_t *group, message_type_t message_type, const void *payload, size_t nbytes){
+    if(message_type == MSG_SPAWN){
+        return -4;
+    }
+    global_data_t* global_data = group->system;
+    pthread_mutex_lock(&group->mutex);
+    long references = (long) group->count + 1;
+    shared_payload* shared = message_pool_alloc(global_data, current_thread_index(global_data),
+                                                sizeof(shared_payload) + nbytes);
+    atomic_init(&shared->references, references);
+    if(nbytes > 0) memcpy(shared + 1, payload, nbytes);
+    message_t message = new_message(message_type, nbytes, shared + 1);
+    size_t delivered = 0;
+    size_t scheduled = 0;
+    size_t i = 0;
+    while(i < group->count){
+        bool schedule;
+        int res = push_messages(global_data, group->members[i], &message, 1, MAILBOX_SHARED, false, &schedule, NULL);
+        if(res < 0){
+            actor_group_erase(group, i);
+            continue;
+        }
+        if(res == 1) delivered += 1;
+        if(schedule) group->scheduled[scheduled++] = group->members[i];
+        i++;
+    }
+    if(scheduled > 0) schedule_actors(global_data, group->scheduled, scheduled);
+    pthread_mutex_unlock(&group->mutex);
+    if(atomic_fetch_sub_explicit(&shared->references, references - (long) delivered,
+                                 memory_order_acq_rel) == references - (long) delivered){
+        message_pool_free(global_data, current_thread_index(global_data), shared);
+    }
+    return (int) delivered;
+}
+
+void *cacti_msg_alloc(size_t nbytes){
+    global_data_t* global_data = enter_system();
+    if(global_data == NULL) return NULL;
+    void* res = message_pool_alloc(global_data, current_thread_index(global_data), nbytes);
+    leave_system();
+    return res;
+}
+
+void cacti_msg_free(void *buffer){
+    global_data_t* global_data = current_system();
+    message_pool_free(global_data, current_thread_index(global_data), buffer);
+}
+
+actor_id_t cacti_actor_id_self(global_data_t* global_data){
+    int index = current_thread_index(global_data);
+    if(index < 0){
+        // A blocking thread sets the executed actor only for the time of its prompts.
+        return thread_system == global_data && executed_actor != NULL ? executed_actor->actor_id : -1;
+    }
+    return global_data->thread_to_actor[index];
+}
+
 actor_id_t actor_id_self(){
-    return global_data.thread_to_actor[current_thread_index()];
+    global_data_t* global_data = current_system();
+    if(global_data == NULL) return -1;
+    return cacti_actor_id_self(global_data);
 }
 
-void spawn_actor(role_t* role){
-    if(global_data.finished) return;
-    actor_id_t new_actor_id;
-    actor_info* new_actor = new_actor_info(role, global_data.num_of_actors);
-    actors_vector_insert(global_data.actors, new_actor);
-    new_actor_id = (global_data.num_of_actors)++;
-    actor_id_t* makers_id = malloc(sizeof(actor_id_t));
-    *makers_id = actor_id_self();
-    global_data.alive_actors += 1;
-    send_message(new_actor_id, new_message(MSG_HELLO, sizeof(actor_id_t*), (void*) makers_id));
+global_data_t *cacti_system_current(){
+    return current_system();
 }
 
-void sync_start_thread(){
-    pthread_mutex_lock(global_data.mutex);
-    while(!global_data.started){
-        pthread_cond_wait(global_data.started_cond, global_data.mutex);
+void spawn_actor(global_data_t* global_data, role_t* role){
+    if(global_data->finished) return;
+    actor_id_t new_actor_id = actors_directory_reserve(global_data->actors);
+    if(new_actor_id < 0){
+        fprintf(stderr, "Warning: rejected request to spawn more than %d actors\n", CAST_LIMIT);
+        destroy_role(role);
+        return;
     }
-    pthread_mutex_unlock(global_data.mutex);
+    actor_info* new_actor = new_actor_info(lock_slab(global_data), role, new_actor_id);
+    unlock_slab(global_data);
+    actors_directory_set(global_data->actors, new_actor);
+#if CACTI_TRACE
+    trace(global_data, TRACE_SPAWN, new_actor_id, MSG_SPAWN, 0);
+#endif
+    actor_id_t* makers_id = malloc(sizeof(actor_id_t));
+    *makers_id = cacti_actor_id_self(global_data);
+    atomic_fetch_add(&global_data->alive_actors, 1);
+    cacti_send_message(global_data, new_actor_id, new_message(MSG_HELLO, sizeof(actor_id_t*), (void*) makers_id));
 }
 
-void enable_start(){
-    pthread_mutex_lock(global_data.mutex);
-    global_data.started = true;
-    for(int i = 0; i < POOL_SIZE; ++i){
-        pthread_cond_signal(global_data.started_cond);
+void sync_start_thread(global_data_t* global_data){
+    pthread_mutex_lock(global_data->mutex);
+    while(!global_data->started){
+        pthread_cond_wait(global_data->started_cond, global_data->mutex);
     }
-    pthread_mutex_unlock(global_data.mutex);
+    pthread_mutex_unlock(global_data->mutex);
+}
+
+void enable_start(global_data_t* global_data){
+    pthread_mutex_lock(global_data->mutex);
+    global_data->started = true;
+    pthread_cond_broadcast(global_data->started_cond);
+    pthread_mutex_unlock(global_data->mutex);
 }
 
 bool valid_order(message_type_t current_order, role_t* current_role){
@@ -125,145 +1338,909 @@ bool valid_order(message_type_t current_order, role_t* current_role){
            current_order == MSG_HELLO || (size_t) current_order < current_role->nprompts;
 }
 
-bool can_enter_loop(actor_info** current_actor, message_t* message) {
-    message_queue* mq = global_data.message_q;
+// With per-node queues, the threads on the same node are robbed first.
+actor_id_t steal_actor(global_data_t* global_data, int index){
+    actor_id_t res;
+    int capacity = global_data->pool_capacity;
+    bool by_node = global_data->node_queues != NULL;
+    int node = global_data->worker_nodes[index];
+    for(int pass = by_node ? 0 : 1; pass < 2; pass++){
+        for(int i = 1; i < capacity; i++){
+            int victim = (index + i) % capacity;
+            if(by_node && (global_data->worker_nodes[victim] == node) != (pass == 0)) continue;
+            do{
+                res = work_deque_steal(global_data->deques[victim]);
+            } while(res == WORK_DEQUE_ABORT);
+            if(res != WORK_DEQUE_EMPTY) return res;
+        }
+    }
+    return WORK_DEQUE_EMPTY;
+}
+
+actor_id_t pop_queue(global_data_t* global_data, message_queue* mq){
+    actor_id_t res = WORK_DEQUE_EMPTY;
     pthread_mutex_lock(mq->mutex);
-    bool res;
-    actor_id_t popped;
-    while(message_queue_empty(mq) && !global_data.finished && global_data.alive_actors > 0){
-        pthread_cond_wait(mq->actor_cond, mq->mutex);
+    if(!message_queue_empty(mq)){
+        res = message_queue_pop(global_data, mq);
     }
-    if(global_data.finished){
-        res = false;
+    pthread_mutex_unlock(mq->mutex);
+    return res;
+}
+
+// Takes the actor from the thread's run-next slot, unless the slot has been taken from
+// run_next_limit times in a row: then the actor is queued behind the ones scheduled from
+// outside, on the thread's node if there are node queues, and it is up to any thread.
+actor_id_t take_run_next(global_data_t* global_data, int index){
+    run_next_slot* slot = &global_data->run_next[index];
+    actor_id_t res = slot->actor;
+    if(res == WORK_DEQUE_EMPTY){
+        slot->streak = 0;
+        return res;
     }
-    else if(global_data.alive_actors == 0){
-        pthread_kill(global_data.director_id, SIGINT);
-        pthread_cond_wait(global_data.message_q->actor_cond, mq->mutex);
-        res = false;
+    slot->actor = WORK_DEQUE_EMPTY;
+    if(slot->streak++ < global_data->config.run_next_limit) return res;
+    slot->streak = 0;
+    int node = global_data->worker_nodes[index];
+    message_queue* mq = global_data->node_queues != NULL && node >= 0 ? global_data->node_queues[node]
+                                                                      : global_data->message_q;
+    pthread_mutex_lock(mq->mutex);
+    message_queue_push(mq, res);
+    pthread_mutex_unlock(mq->mutex);
+    wake_idle_threads(global_data, 1);
+    return WORK_DEQUE_EMPTY;
+}
+
+// Looks for an actor waiting for execution: first in the thread's run-next slot and deque,
+// then in the queue of its node, then in the global queue, then in the deques of other
+// threads, and finally in the queues of other nodes.
+actor_id_t find_actor(global_data_t* global_data, int index){
+    actor_id_t res = take_run_next(global_data, index);
+    if(res != WORK_DEQUE_EMPTY) return res;
+    res = work_deque_pop(global_data->deques[index]);
+    if(res != WORK_DEQUE_EMPTY) return res;
+    int node = global_data->worker_nodes[index];
+    if(global_data->node_queues != NULL && node >= 0){
+        res = pop_queue(global_data, global_data->node_queues[node]);
+        if(res != WORK_DEQUE_EMPTY) return res;
     }
-    else{
-        popped = message_queue_pop(&global_data);
-        *current_actor = global_data.actors->actors[popped];
-        set_waiting(*current_actor, false);
-        *message = bl_queue_pop((*current_actor)->messages);
-        res = true;
+    res = pop_queue(global_data, global_data->message_q);
+    if(res != WORK_DEQUE_EMPTY) return res;
+    res = steal_actor(global_data, index);
+#if CACTI_METRICS
+    if(res != WORK_DEQUE_EMPTY) metric_add(&own_metrics->steals, 1);
+#endif
+    if(res != WORK_DEQUE_EMPTY || global_data->node_queues == NULL) return res;
+    for(int i = 0; i < global_data->nodes && res == WORK_DEQUE_EMPTY; i++){
+        if(i != node) res = pop_queue(global_data, global_data->node_queues[i]);
     }
-    pthread_mutex_unlock(mq->mutex);
     return res;
 }
 
-void* working_thread() {
-    sync_start_thread();
-    message_t current_message;
-    role_t* current_role;
-    actor_info* current_actor;
-    void** stateptr;
-    message_type_t current_message_type;
-    while(can_enter_loop(&current_actor, &current_message)){
-        set_executed_actor(current_actor->actor_id);
-        current_role = current_actor->role;
-        current_message_type = current_message.message_type;
-        if(!valid_order(current_message_type, current_role)){
-            fprintf(stderr, "Warning: trying to access a non-existent actor function\n");
-            continue;
+bool work_available(global_data_t* global_data){
+    if(!message_queue_empty(global_data->message_q)) return true;
+    if(global_data->node_queues != NULL){
+        for(int i = 0; i < global_data->nodes; i++){
+            if(!message_queue_empty(global_data->node_queues[i])) return true;
         }
-        if(current_message_type == MSG_GODIE){
-            kill_actor(current_actor);
-            join_queue(current_actor);
-        }
-        else{
-            if(current_message_type == MSG_SPAWN){
-                spawn_actor((role_t*) current_message.data);
+    }
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        if(!work_deque_empty(global_data->deques[i])) return true;
+    }
+    return false;
+}
+
+// Spins, then yields the CPU, as configured, until there may be some work to do.
+bool spin_for_work(global_data_t* global_data){
+    for(int i = 0; i < global_data->config.idle_spins; i++){
+        if(work_available(global_data) || global_data->finished) return true;
+        cpu_relax();
+    }
+    for(int i = 0; i < global_data->config.idle_yields; i++){
+        if(work_available(global_data) || global_data->finished) return true;
+        sched_yield();
+    }
+    return false;
+}
+
+// Waits until there may be some work to do: first spinning, then parked on the futex.
+// Threads scheduling actors only wake parked threads up if they see some, so the counter
+// is incremented, and the futex word read, before checking for work.
+// Returns false if the thread should exit, because the system is finishing or the elastic pool
+// has been idle for too long.
+bool wait_for_work(global_data_t* global_data){
+    bool res = true;
+#if CACTI_METRICS
+    uint64_t idle_since = metrics_clock();
+#endif
+    atomic_fetch_add(&global_data->idle_threads, 1);
+    if(!spin_for_work(global_data)){
+        atomic_fetch_add(&global_data->parked_threads, 1);
+        unsigned wakeups = atomic_load(&global_data->idle_futex);
+        if(!work_available(global_data) && !global_data->finished){
+#if CACTI_METRICS
+            metric_add(&own_metrics->parks, 1);
+#endif
+            if(global_data->stalled[current_thread_index(global_data)] != NULL){
+                // The stalled actors are retried every now and then, and they keep the thread alive.
+                futex_wait(&global_data->idle_futex, wakeups, BACKPRESSURE_RETRY_USEC);
+            }
+            else if(global_data->config.elastic){
+                if(!futex_wait(&global_data->idle_futex, wakeups, global_data->config.idle_usec) &&
+                        !work_available(global_data) && shrink_pool(global_data)){
+                    res = false;
+                }
             }
             else{
-                stateptr = &(current_actor->stateptr);
-                (current_role->prompts[current_message_type])(stateptr, current_message.nbytes, current_message.data);
+                futex_wait(&global_data->idle_futex, wakeups, 0);
             }
-            join_queue(current_actor);
+        }
+        atomic_fetch_sub(&global_data->parked_threads, 1);
+    }
+    atomic_fetch_sub(&global_data->idle_threads, 1);
+#if CACTI_METRICS
+    metric_add(&own_metrics->idle_nsec, metrics_clock() - idle_since);
+#endif
+    return res && !global_data->finished;
+}
+
+// Keeps the actor, whose deferred sends could not all be delivered, off the deques.
+// It stays marked as waiting, so nobody else schedules it meanwhile.
+void stall_actor(global_data_t* global_data, int index, actor_info* current_actor){
+    current_actor->stall->next_stalled = global_data->stalled[index];
+    global_data->stalled[index] = current_actor;
+}
+
+// Retries the deferred sends of the thread's stalled actors, and lets go of the ones
+// which have delivered all of them.
+void retry_stalled(global_data_t* global_data, int index){
+    actor_info** link = &global_data->stalled[index];
+    while(*link != NULL){
+        actor_info* current_actor = *link;
+        actor_info* next = current_actor->stall->next_stalled;
+        if(flush_deferred(global_data, current_actor)){
+            *link = next;
+            leave_actor(global_data, current_actor);
+        }
+        else{
+            link = &current_actor->stall->next_stalled;
         }
     }
-    pthread_mutex_lock(global_data.mutex);
-    global_data.finished_threads += 1;
-    if(global_data.finished_threads == POOL_SIZE){
-        pthread_cond_signal(global_data.thread_join_cond);
+}
+
+// An actor may be scheduled by a sender whose message has already been executed
+// during the previous activation, so its queue is checked again here. An actor whose
+// next message is for a blocking prompt is handed over to the blocking pool instead.
+bool can_enter_loop(global_data_t* global_data, int index, actor_info** current_actor) {
+    actor_id_t found;
+    while(true){
+        if(global_data->stalled[index] != NULL) retry_stalled(global_data, index);
+        found = find_actor(global_data, index);
+        while(found == WORK_DEQUE_EMPTY){
+            if(!wait_for_work(global_data)) return false;
+            if(global_data->stalled[index] != NULL) retry_stalled(global_data, index);
+            found = find_actor(global_data, index);
+        }
+        if(global_data->finished) return false;
+        *current_actor = actors_directory_get(global_data->actors, found);
+        if(!mailbox_empty(*current_actor) && !next_blocking(global_data, *current_actor)) return true;
+        leave_actor(global_data, *current_actor);
     }
-    pthread_mutex_unlock(global_data.mutex);
+}
+
+void execute_message(global_data_t* global_data, actor_info* current_actor, message_t current_message){
+    role_t* current_role = current_actor->role;
+    message_type_t current_message_type = current_message.message_type;
+#if CACTI_TRACE
+    trace(global_data, TRACE_DISPATCH_START, -1, current_message_type, 0);
+#endif
+    if(!valid_order(current_message_type, current_role)){
+        fprintf(stderr, "Warning: trying to access a non-existent actor function\n");
+    }
+    else if(current_message_type == MSG_GODIE){
+        kill_actor(current_actor);
+#if CACTI_TRACE
+        trace(global_data, TRACE_DEATH, -1, current_message_type, 0);
+#endif
+    }
+    else if(current_message_type == MSG_SPAWN){
+        spawn_actor(global_data, (role_t*) current_message.data);
+    }
+    else{
+        void** stateptr = &(current_actor->stateptr);
+        (current_role->prompts[current_message_type])(stateptr, current_message.nbytes, current_message.data);
+    }
+#if CACTI_TRACE
+    trace(global_data, TRACE_DISPATCH_END, -1, current_message_type, 0);
+#endif
+}
+
+#if CACTI_METRICS
+// Counts a message executed by the current thread, which waited in the queue since sent,
+// and whose prompt started then.
+void record_message(actor_info* current_actor, message_type_t message_type, uint64_t sent, uint64_t started){
+    uint64_t now = metrics_clock();
+    int prompt = metrics_prompt(message_type);
+    metric_add(&own_metrics->messages, 1);
+    metric_add(&own_metrics->queue_wait[prompt][metrics_bucket(started > sent ? started - sent : 0)], 1);
+    metric_add(&own_metrics->run_time[prompt][metrics_bucket(now - started)], 1);
+    metric_add(&current_actor->executed, 1);
+}
+#endif
+
+// Executes the actor's messages until its mailbox is empty or the throughput quantum runs out,
+// so that a busy actor is not rescheduled after every message, but does not starve others either.
+// The priority lane is checked before every message. A working thread stops before a message
+// for a blocking prompt, and a blocking thread before any other.
+void execute_messages(global_data_t* global_data, actor_info* current_actor, bool blocking){
+    size_t max_messages = atomic_load_explicit(&global_data->throughput_messages, memory_order_relaxed);
+    long max_usec = atomic_load_explicit(&global_data->throughput_usec, memory_order_relaxed);
+    struct timespec start;
+    if(max_usec > 0) clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t executed = 0;
+    _Alignas(max_align_t) unsigned char payload[MESSAGE_INLINE_SIZE];
+    payload_kind kind;
+#if CACTI_METRICS
+    metric_add(&own_metrics->activations, 1);
+#endif
+    do{
+        priority_message* urgent = priority_lane_pop(&current_actor->priority);
+#if CACTI_METRICS
+        message_type_t message_type = urgent != NULL ? urgent->message.message_type
+                                                     : bl_queue_front_type(&current_actor->messages);
+        uint64_t sent = urgent != NULL ? urgent->sent : bl_queue_front_sent(&current_actor->messages);
+        uint64_t started = metrics_clock();
+#endif
+        if(urgent != NULL){
+            execute_message(global_data, current_actor, urgent->message);
+            if(urgent->kind == MAILBOX_SHARED) release_shared_payload(global_data, urgent->message.data);
+            message_pool_free(global_data, current_thread_index(global_data), urgent);
+        }
+        else{
+            message_t message = bl_queue_pop(&current_actor->messages, payload, &kind);
+            execute_message(global_data, current_actor, message);
+            if(kind == MAILBOX_SHARED) release_shared_payload(global_data, message.data);
+        }
+#if CACTI_METRICS
+        record_message(current_actor, message_type, sent, started);
+#endif
+        executed += 1;
+    } while(executed < max_messages && current_actor->stall == NULL && !mailbox_empty(current_actor) &&
+            next_blocking(global_data, current_actor) == blocking && (max_usec == 0 || microseconds_since(&start) < max_usec));
+}
+
+void* working_thread(void* start) {
+    global_data_t* global_data = ((worker_start*) start)->global_data;
+    int index = ((worker_start*) start)->slot;
+    free(start);
+    pin_thread(global_data, index);
+    sync_start_thread(global_data);
+    thread_system = global_data;
+    thread_index = index;
+#if CACTI_METRICS
+    own_metrics = &global_data->metrics[index];
+#endif
+#if CACTI_TRACE
+    own_trace = atomic_load(&global_data->traces[index]);
+    if(own_trace == NULL){
+        own_trace = new_trace_ring(index);
+        atomic_store(&global_data->traces[index], own_trace);
+    }
+#endif
+    actor_info* current_actor;
+    while(can_enter_loop(global_data, index, &current_actor)){
+        set_executed_actor(global_data, index, current_actor->actor_id);
+        executed_actor = current_actor;
+        execute_messages(global_data, current_actor, false);
+        notify_blocked_senders(global_data, current_actor);
+        if(current_actor->stall != NULL && !flush_deferred(global_data, current_actor)){
+            stall_actor(global_data, index, current_actor);
+        }
+        else{
+            leave_actor(global_data, current_actor);
+        }
+    }
+    atomic_store(&global_data->thread_slots[index], false);
+    pthread_mutex_lock(global_data->mutex);
+    global_data->running_threads -= 1;
+    if(global_data->running_threads == 0){
+        pthread_cond_signal(global_data->thread_join_cond);
+    }
+    pthread_mutex_unlock(global_data->mutex);
+    return NULL;
+}
+
+// Executes the blocking prompts. Outside the pool of working threads, a blocking thread
+// may block in its prompts, e.g. in send_message_wait, without holding up other actors.
+// It exits once it has been idle for idle_usec, or the system is finishing.
+void* blocking_thread(void* system){
+    global_data_t* global_data = system;
+    thread_system = global_data;
+    message_queue* mq = global_data->blocking_q;
+    pthread_mutex_lock(mq->mutex);
+#if CACTI_METRICS
+    own_metrics = global_data->free_metrics;
+    if(own_metrics != NULL){
+        global_data->free_metrics = own_metrics->next_free;
+    }
+    else{
+        own_metrics = new_thread_metrics();
+        own_metrics->next = global_data->blocking_metrics;
+        global_data->blocking_metrics = own_metrics;
+    }
+#endif
+#if CACTI_TRACE
+    own_trace = global_data->free_traces;
+    if(own_trace != NULL){
+        global_data->free_traces = own_trace->next_free;
+    }
+    else{
+        own_trace = new_trace_ring(global_data->pool_capacity + global_data->blocking_tracks++);
+        own_trace->next = global_data->blocking_traces;
+        global_data->blocking_traces = own_trace;
+    }
+#endif
+    while(!global_data->finished){
+        if(message_queue_empty(mq)){
+            struct timespec deadline = realtime_after(global_data->config.idle_usec);
+            global_data->idle_blocking += 1;
+#if CACTI_METRICS
+            uint64_t idle_since = metrics_clock();
+            metric_add(&own_metrics->parks, 1);
+#endif
+            int err = pthread_cond_timedwait(global_data->blocking_cond, mq->mutex, &deadline);
+#if CACTI_METRICS
+            metric_add(&own_metrics->idle_nsec, metrics_clock() - idle_since);
+#endif
+            global_data->idle_blocking -= 1;
+            if(err == ETIMEDOUT && message_queue_empty(mq)) break;
+            continue;
+        }
+        // The system may have finished since the check above, then there is nothing to pop.
+        actor_id_t found = message_queue_pop(global_data, mq);
+        if(found == WORK_DEQUE_EMPTY) break;
+        actor_info* current_actor = actors_directory_get(global_data->actors, found);
+        pthread_mutex_unlock(mq->mutex);
+        executed_actor = current_actor;
+        execute_messages(global_data, current_actor, true);
+        executed_actor = NULL;
+        notify_blocked_senders(global_data, current_actor);
+        leave_actor(global_data, current_actor);
+        pthread_mutex_lock(mq->mutex);
+    }
+    global_data->blocking_threads -= 1;
+#if CACTI_METRICS
+    own_metrics->next_free = global_data->free_metrics;
+    global_data->free_metrics = own_metrics;
+#endif
+#if CACTI_TRACE
+    own_trace->next_free = global_data->free_traces;
+    global_data->free_traces = own_trace;
+#endif
+    pthread_cond_broadcast(global_data->blocking_cond);
+    pthread_mutex_unlock(mq->mutex);
     return NULL;
 }
 
 // Waiting for the working threads to finish after instructing them to do so.
-void director_join(){
-    pthread_mutex_lock(global_data.mutex);
-    global_data.finished = true;
-    pthread_mutex_lock(global_data.message_q->mutex);
-    for(int i = 0; i < POOL_SIZE; i++){
-        pthread_cond_signal(global_data.message_q->actor_cond);
-    }
-    pthread_mutex_unlock(global_data.message_q->mutex);
-    while(global_data.finished_threads < POOL_SIZE){
-        pthread_cond_wait(global_data.thread_join_cond, global_data.mutex);
-    }
-    pthread_mutex_unlock(global_data.mutex);
-}
-
-// A 'director' thread responsible for a synchronized start of the working threads,
-// the cleanup, and receiving an externally-sent SIGINT (if necessary).
-void* director(){
-    global_data.actors->occupied = 1;
-    enable_start();
-
-    // Waiting for a SIGINT, sent either from outside the process or from a
-    // working thread (which, to simplify the process of ending the program
-    // execution, sends it if all the actors are dead).
-    sigset_t sigint_set = new_sigint_set();
-    int sig;
-    sigwait(&sigint_set, &sig);
-
-    director_join();
-    destroy_system(&global_data);
+void director_join(global_data_t* global_data){
+    pthread_mutex_lock(global_data->mutex);
+    global_data->finished = true;
+    pthread_mutex_unlock(global_data->mutex);
+    stop_timer_thread(global_data);
+    stop_reactor(global_data);
+    pthread_mutex_lock(global_data->backpressure_mutex);
+    pthread_cond_broadcast(global_data->space_cond);
+    pthread_mutex_unlock(global_data->backpressure_mutex);
+    atomic_fetch_add(&global_data->idle_futex, 1);
+    futex_wake(&global_data->idle_futex, INT_MAX);
+    pthread_mutex_lock(global_data->mutex);
+    while(global_data->running_threads > 0){
+        pthread_cond_wait(global_data->thread_join_cond, global_data->mutex);
+    }
+    pthread_mutex_unlock(global_data->mutex);
+    message_queue* mq = global_data->blocking_q;
+    pthread_mutex_lock(mq->mutex);
+    pthread_cond_broadcast(global_data->blocking_cond);
+    while(global_data->blocking_threads > 0){
+        pthread_cond_wait(global_data->blocking_cond, mq->mutex);
+    }
+    pthread_mutex_unlock(mq->mutex);
+}
+
+// The systems created with stop_on_sigint, all of which a SIGINT stops.
+global_data_t* interruptible_systems = NULL;
+pthread_mutex_t interruptible_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t sigint_once = PTHREAD_ONCE_INIT;
+sem_t sigint_semaphore;
+
+void on_sigint(int sig){
+    (void) sig;
+    sem_post(&sigint_semaphore);
+}
+
+// Stops the interruptible systems after every SIGINT. The handler itself may not
+// touch their mutexes, so it only posts the semaphore.
+void* sigint_watcher(void* unused){
+    (void) unused;
+    while(true){
+        if(sem_wait(&sigint_semaphore) != 0) continue;
+        pthread_mutex_lock(&interruptible_mutex);
+        for(global_data_t* system = interruptible_systems; system != NULL; system = system->next_interruptible){
+            notify_finish(system, true);
+        }
+        pthread_mutex_unlock(&interruptible_mutex);
+    }
     return NULL;
 }
 
-void actor_system_join(actor_id_t actor){
-    pthread_mutex_lock(global_data.mutex);
-    if(!actor_exists(actor)){
-        pthread_mutex_unlock(global_data.mutex);
+void install_sigint_handler(){
+    sem_init(&sigint_semaphore, 0, 0);
+    pthread_t watcher;
+    if(pthread_create(&watcher, NULL, &sigint_watcher, NULL) != 0){
+        fprintf(stderr, "Warning: could not start the SIGINT watcher\n");
+        return;
+    }
+    pthread_detach(watcher);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &on_sigint;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+}
+
+void add_interruptible(global_data_t* global_data){
+    pthread_once(&sigint_once, &install_sigint_handler);
+    pthread_mutex_lock(&interruptible_mutex);
+    global_data->next_interruptible = interruptible_systems;
+    interruptible_systems = global_data;
+    pthread_mutex_unlock(&interruptible_mutex);
+}
+
+void remove_interruptible(global_data_t* global_data){
+    pthread_mutex_lock(&interruptible_mutex);
+    global_data_t** link = &interruptible_systems;
+    while(*link != NULL && *link != global_data) link = &(*link)->next_interruptible;
+    if(*link != NULL) *link = global_data->next_interruptible;
+    pthread_mutex_unlock(&interruptible_mutex);
+}
+
+#if CACTI_METRICS
+void add_thread_metrics(cacti_metrics_t* metrics, cacti_worker_metrics_t* worker, thread_metrics* tm){
+    worker->messages += atomic_load_explicit(&tm->messages, memory_order_relaxed);
+    worker->activations += atomic_load_explicit(&tm->activations, memory_order_relaxed);
+    worker->steals += atomic_load_explicit(&tm->steals, memory_order_relaxed);
+    worker->parks += atomic_load_explicit(&tm->parks, memory_order_relaxed);
+    worker->idle_usec += atomic_load_explicit(&tm->idle_nsec, memory_order_relaxed) / 1000;
+    for(int i = 0; i <= CACTI_METRICS_PROMPTS; i++){
+        for(int j = 0; j < CACTI_METRICS_BUCKETS; j++){
+            metrics->queue_wait[i].counts[j] += atomic_load_explicit(&tm->queue_wait[i][j], memory_order_relaxed);
+            metrics->run_time[i].counts[j] += atomic_load_explicit(&tm->run_time[i][j], memory_order_relaxed);
+        }
+    }
+}
+#endif
+
+int cacti_metrics_snapshot(global_data_t* global_data, cacti_metrics_t* metrics){
+#if CACTI_METRICS
+    memset(metrics, 0, sizeof(cacti_metrics_t));
+    metrics->nworkers = global_data->pool_capacity + 1;
+    metrics->workers = calloc(metrics->nworkers, sizeof(cacti_worker_metrics_t));
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        add_thread_metrics(metrics, &metrics->workers[i], &global_data->metrics[i]);
+    }
+    pthread_mutex_lock(global_data->blocking_q->mutex);
+    for(thread_metrics* tm = global_data->blocking_metrics; tm != NULL; tm = tm->next){
+        add_thread_metrics(metrics, &metrics->workers[global_data->pool_capacity], tm);
+    }
+    pthread_mutex_unlock(global_data->blocking_q->mutex);
+    for(int i = 0; i < metrics->nworkers; i++){
+        metrics->total.messages += metrics->workers[i].messages;
+        metrics->total.activations += metrics->workers[i].activations;
+        metrics->total.steals += metrics->workers[i].steals;
+        metrics->total.parks += metrics->workers[i].parks;
+        metrics->total.idle_usec += metrics->workers[i].idle_usec;
+    }
+    return 0;
+#else
+    (void) global_data;
+    (void) metrics;
+    return -1;
+#endif
+}
+
+void cacti_metrics_release(cacti_metrics_t* metrics){
+    free(metrics->workers);
+    metrics->workers = NULL;
+}
+
+unsigned long cacti_histogram_quantile(const cacti_histogram_t* histogram, double quantile){
+    unsigned long total = 0;
+    for(int i = 0; i < CACTI_METRICS_BUCKETS; i++) total += histogram->counts[i];
+    if(total == 0) return 0;
+    unsigned long rank = (unsigned long) (quantile * total);
+    if(rank >= total) rank = total - 1;
+    unsigned long seen = 0;
+    int bucket = 0;
+    while(seen + histogram->counts[bucket] <= rank){
+        seen += histogram->counts[bucket];
+        bucket += 1;
+    }
+    return 2UL << bucket;
+}
+
+// The actor is held like by a sender, so that its record is not reused meanwhile.
+int cacti_actor_metrics(global_data_t* global_data, actor_id_t actor, cacti_actor_metrics_t* metrics){
+#if CACTI_METRICS
+    if(!actor_exists(global_data, actor)) return -2;
+    actor_info* current_actor = actors_directory_get(global_data->actors, actor);
+    if(current_actor == NULL) return -1;
+    int res = -1;
+    atomic_fetch_add(&current_actor->senders, 1);
+    if(current_actor->actor_id == actor){
+        metrics->depth = bl_queue_depth(&current_actor->messages);
+        metrics->high_water = atomic_load_explicit(&current_actor->messages.high_water, memory_order_relaxed);
+        metrics->messages = atomic_load_explicit(&current_actor->executed, memory_order_relaxed);
+        res = 0;
+    }
+    atomic_fetch_sub(&current_actor->senders, 1);
+    return res;
+#else
+    (void) global_data;
+    (void) actor;
+    (void) metrics;
+    return -1;
+#endif
+}
+
+#if CACTI_METRICS
+void write_histograms(FILE* out, const char* name, const cacti_histogram_t* histogram){
+    fprintf(out, " %s p50 %lu p99 %lu ns", name, cacti_histogram_quantile(histogram, 0.5),
+            cacti_histogram_quantile(histogram, 0.99));
+}
+
+// Appends a summary of the metrics to the configured file, or writes it to stderr:
+// the totals, then a line for every prompt which has executed any messages.
+void dump_metrics(global_data_t* global_data){
+    cacti_metrics_t* metrics = malloc(sizeof(cacti_metrics_t));
+    cacti_metrics_snapshot(global_data, metrics);
+    const char* path = global_data->config.metrics_dump_path;
+    FILE* out = path != NULL ? fopen(path, "a") : stderr;
+    if(out == NULL){
+        fprintf(stderr, "Warning: could not open %s for the metrics\n", path);
+        global_data->config.metrics_dump_usec = 0;
+    }
+    else{
+        fprintf(out, "cacti metrics: messages %lu activations %lu steals %lu parks %lu idle %lu us\n",
+                metrics->total.messages, metrics->total.activations, metrics->total.steals,
+                metrics->total.parks, metrics->total.idle_usec);
+        for(int i = 0; i <= CACTI_METRICS_PROMPTS; i++){
+            unsigned long count = 0;
+            for(int j = 0; j < CACTI_METRICS_BUCKETS; j++) count += metrics->run_time[i].counts[j];
+            if(count == 0) continue;
+            if(i < CACTI_METRICS_PROMPTS) fprintf(out, "  prompt %d: messages %lu", i, count);
+            else fprintf(out, "  other: messages %lu", count);
+            write_histograms(out, "queue wait", &metrics->queue_wait[i]);
+            write_histograms(out, "run time", &metrics->run_time[i]);
+            fprintf(out, "\n");
+        }
+        if(out != stderr) fclose(out);
+    }
+    cacti_metrics_release(metrics);
+    free(metrics);
+}
+
+// Waits on finish_cond like the director, dumping the metrics whenever the period passes.
+void wait_dumping_metrics(global_data_t* global_data){
+    struct timespec next_dump = realtime_after(global_data->config.metrics_dump_usec);
+    while(!global_data->stopping && global_data->config.metrics_dump_usec > 0){
+        if(pthread_cond_timedwait(global_data->finish_cond, global_data->mutex, &next_dump) == ETIMEDOUT &&
+                !global_data->stopping){
+            pthread_mutex_unlock(global_data->mutex);
+            dump_metrics(global_data);
+            pthread_mutex_lock(global_data->mutex);
+            next_dump = realtime_after(global_data->config.metrics_dump_usec);
+        }
+    }
+}
+#endif
+
+#if CACTI_TRACE
+// Writes an event as a JSON object, with its timestamp converted to microseconds.
+void write_trace_event(FILE* out, const trace_event* event, int tid, double usec){
+    int pid = (int) getpid();
+    switch(event->kind){
+        case TRACE_DISPATCH_START:
+            if(event->message_type == MSG_SPAWN) fprintf(out, "{\"name\":\"spawn\"");
+            else if(event->message_type == MSG_GODIE) fprintf(out, "{\"name\":\"godie\"");
+            else fprintf(out, "{\"name\":\"prompt %ld\"", event->message_type);
+            fprintf(out, ",\"cat\":\"prompt\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                         "\"args\":{\"actor\":%ld}}", usec, pid, tid, event->actor);
+            break;
+        case TRACE_DISPATCH_END:
+            fprintf(out, "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", usec, pid, tid);
+            break;
+        case TRACE_SEND:
+        case TRACE_ENQUEUE:
+            fprintf(out, "{\"name\":\"%s\",\"cat\":\"message\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                         "\"pid\":%d,\"tid\":%d,\"args\":{\"from\":%ld,\"to\":%ld,\"type\":%ld,\"%s\":%ld}}",
+                    event->kind == TRACE_SEND ? "send" : "enqueue", usec, pid, tid, event->actor, event->other,
+                    event->message_type, event->kind == TRACE_SEND ? "count" : "result", event->value);
+            break;
+        case TRACE_SPAWN:
+            fprintf(out, "{\"name\":\"spawn\",\"cat\":\"actor\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                         "\"pid\":%d,\"tid\":%d,\"args\":{\"parent\":%ld,\"actor\":%ld}}",
+                    usec, pid, tid, event->actor, event->other);
+            break;
+        case TRACE_DEATH:
+            fprintf(out, "{\"name\":\"death\",\"cat\":\"actor\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                         "\"pid\":%d,\"tid\":%d,\"args\":{\"actor\":%ld}}", usec, pid, tid, event->actor);
+            break;
+    }
+}
+
+// Writes out the ring's events since the last flush, after naming its track. An event is
+// copied before the ring is checked for having claimed its slot for a newer one meanwhile.
+void write_trace_ring(global_data_t* global_data, FILE* out, trace_ring* ring, double usec_per_tick){
+    int tid = ring->track + 1;
+    if(ring->track < 0) fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                                     "\"args\":{\"name\":\"outside\"}}", (int) getpid(), tid);
+    else fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                      "\"args\":{\"name\":\"%s %d\"}}", (int) getpid(), tid,
+                 ring->track < global_data->pool_capacity ? "worker" : "blocking",
+                 ring->track < global_data->pool_capacity ? ring->track : ring->track - global_data->pool_capacity);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t position = ring->flushed;
+    if(head - position > CACTI_TRACE_EVENTS) position = head - CACTI_TRACE_EVENTS;
+    for(; position < head; position++){
+        trace_event event = ring->events[position % CACTI_TRACE_EVENTS];
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&ring->claimed, memory_order_relaxed) - position > CACTI_TRACE_EVENTS) continue;
+        fprintf(out, ",\n");
+        write_trace_event(out, &event, tid, (event.tsc - global_data->trace_start_tsc) * usec_per_tick);
+    }
+    ring->flushed = head;
+}
+#endif
+
+int cacti_trace_flush(global_data_t* global_data, const char* path){
+#if CACTI_TRACE
+    FILE* out = fopen(path, "w");
+    if(out == NULL) return -1;
+    // Blocking threads' rings are only ever prepended to the list.
+    pthread_mutex_lock(global_data->blocking_q->mutex);
+    trace_ring* blocking = global_data->blocking_traces;
+    pthread_mutex_unlock(global_data->blocking_q->mutex);
+    pthread_mutex_lock(global_data->trace_mutex);
+    uint64_t ticks = trace_clock() - global_data->trace_start_tsc;
+    struct timespec start = global_data->trace_start;
+    double usec_per_tick = ticks > 0 ? (double) microseconds_since(&start) / ticks : 0;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\","
+                 "\"pid\":%d,\"args\":{\"name\":\"cacti\"}}", (int) getpid());
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        trace_ring* ring = atomic_load(&global_data->traces[i]);
+        if(ring != NULL) write_trace_ring(global_data, out, ring, usec_per_tick);
+    }
+    for(trace_ring* ring = blocking; ring != NULL; ring = ring->next){
+        write_trace_ring(global_data, out, ring, usec_per_tick);
+    }
+    if(global_data->outside_trace != NULL) write_trace_ring(global_data, out, global_data->outside_trace, usec_per_tick);
+    fprintf(out, "\n]}\n");
+    pthread_mutex_unlock(global_data->trace_mutex);
+    bool failed = ferror(out);
+    return fclose(out) != 0 || failed ? -1 : 0;
+#else
+    (void) global_data;
+    (void) path;
+    return -1;
+#endif
+}
+
+// A 'director' thread responsible for a synchronized start of the working threads, and for
+// stopping them once the last actor is reclaimed, or SIGINT comes. The system is freed
+// by the thread which joins it.
+void* director(void* system){
+    global_data_t* global_data = system;
+    enable_start(global_data);
+    pthread_mutex_lock(global_data->mutex);
+#if CACTI_METRICS
+    wait_dumping_metrics(global_data);
+#endif
+    while(!global_data->stopping){
+        pthread_cond_wait(global_data->finish_cond, global_data->mutex);
+    }
+    pthread_mutex_unlock(global_data->mutex);
+
+    director_join(global_data);
+#if CACTI_METRICS
+    if(global_data->config.metrics_dump_usec > 0) dump_metrics(global_data);
+#endif
+    if(global_data->config.trace_path != NULL && cacti_trace_flush(global_data, global_data->config.trace_path) != 0){
+        fprintf(stderr, "Warning: could not write the trace to %s\n", global_data->config.trace_path);
+    }
+    if(global_data->config.stop_on_sigint) remove_interruptible(global_data);
+    return NULL;
+}
+
+// Whether the actor has not been reclaimed yet. Its slot may hold a newer actor by now, and its
+// record may have been reused too, but then it has a different ID.
+bool actor_unreclaimed(global_data_t* global_data, actor_id_t actor){
+    actor_info* ai = actors_directory_get(global_data->actors, actor);
+    return ai != NULL && ai->actor_id == actor;
+}
+
+// Waits, with the system's mutex held, until the actor is reclaimed or the system stops.
+// A reclaimed actor only wakes joiners up if it sees them, so they count themselves first.
+void wait_for_actor(global_data_t* global_data, actor_id_t actor){
+    atomic_fetch_add(&global_data->actor_joiners, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while(!global_data->stopping && actor_unreclaimed(global_data, actor)){
+        pthread_cond_wait(global_data->finish_cond, global_data->mutex);
+    }
+    atomic_fetch_sub(&global_data->actor_joiners, 1);
+}
+
+void cacti_actor_join(global_data_t* global_data, actor_id_t actor){
+    pthread_mutex_lock(global_data->mutex);
+    if(!actor_exists(global_data, actor)){
         fprintf(stderr, "Warning: rejected request to wait for a non-existent actor\n");
     }
     else{
-        pthread_mutex_unlock(global_data.mutex);
-        pthread_join(global_data.director_id, NULL);
+        wait_for_actor(global_data, actor);
     }
+    pthread_mutex_unlock(global_data->mutex);
 }
 
-int actor_system_create(actor_id_t *actor, role_t *const role){
+void cacti_system_join(global_data_t* global_data, actor_id_t actor){
+    pthread_mutex_lock(global_data->mutex);
+    if(!actor_exists(global_data, actor)){
+        pthread_mutex_unlock(global_data->mutex);
+        fprintf(stderr, "Warning: rejected request to wait for a non-existent actor\n");
+    }
+    else{
+        pthread_mutex_unlock(global_data->mutex);
+        pthread_join(global_data->director_id, NULL);
+        destroy_system(global_data);
+        free(global_data);
+    }
+}
+
+// The default system is only let go of once it has finished, so that other threads sending
+// to it meanwhile get -1 rather than no system at all, and freed once none of them uses it.
+void actor_system_join(actor_id_t actor){
+    global_data_t* global_data = atomic_load(&default_system);
+    if(global_data == NULL || !actor_exists(global_data, actor)){
+        fprintf(stderr, "Warning: rejected request to wait for a non-existent actor\n");
+        return;
+    }
+    pthread_join(global_data->director_id, NULL);
+    atomic_store(&default_system, NULL);
+    while(atomic_load(&default_users) > 0) sched_yield();
+    destroy_system(global_data);
+    free(global_data);
+}
+
+void actor_system_default_config(actor_system_config_t *config){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config->workers = cpus > 0 ? (int) cpus : POOL_SIZE;
+    config->elastic = false;
+    config->min_workers = 1;
+    config->max_workers = config->workers;
+    config->grow_depth = 4;
+    config->idle_usec = 100000;
+    config->blocking_workers = BLOCKING_WORKERS;
+    config->idle_spins = IDLE_SPINS;
+    config->idle_yields = IDLE_YIELDS;
+    config->run_next_limit = RUN_NEXT_LIMIT;
+    config->throughput_messages = THROUGHPUT_MESSAGES;
+    config->throughput_usec = THROUGHPUT_USEC;
+    config->affinity = CACTI_AFFINITY_NONE;
+    config->cpus = NULL;
+    config->ncpus = 0;
+    config->blocking_prompts = NULL;
+    config->nblocking_prompts = 0;
+    config->stop_on_sigint = false;
+    config->metrics_dump_usec = 0;
+    config->metrics_dump_path = NULL;
+    config->trace_path = NULL;
+}
+
+// Makes the worker counts consistent: 1 <= min_workers <= workers <= max_workers.
+// A fixed pool has all three equal.
+actor_system_config_t normalize_config(const actor_system_config_t *config){
+    actor_system_config_t res = *config;
+    if(res.workers <= 0){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        res.workers = cpus > 0 ? (int) cpus : POOL_SIZE;
+    }
+    if(!res.elastic){
+        res.min_workers = res.workers;
+        res.max_workers = res.workers;
+    }
+    if(res.min_workers < 1) res.min_workers = 1;
+    if(res.min_workers > res.workers) res.min_workers = res.workers;
+    if(res.max_workers < res.workers) res.max_workers = res.workers;
+    if(res.grow_depth < 1) res.grow_depth = 1;
+    if(res.blocking_workers < 1) res.blocking_workers = 1;
+    if(res.blocking_prompts == NULL || res.nblocking_prompts < 0) res.nblocking_prompts = 0;
+    // Spinning only pays off if another CPU may meanwhile schedule some work.
+    if(res.idle_spins < 0 || sysconf(_SC_NPROCESSORS_ONLN) < 2) res.idle_spins = 0;
+    if(res.idle_yields < 0) res.idle_yields = 0;
+    if(res.run_next_limit < 0) res.run_next_limit = 0;
+    if(res.throughput_messages == 0) res.throughput_messages = 1;
+    if(res.throughput_usec < 0) res.throughput_usec = 0;
+    if(res.affinity == CACTI_AFFINITY_CPUS && (res.cpus == NULL || res.ncpus <= 0)){
+        fprintf(stderr, "Warning: rejected request to pin threads to an empty list of CPUs\n");
+        res.affinity = CACTI_AFFINITY_NONE;
+    }
+    if(res.metrics_dump_usec < 0) res.metrics_dump_usec = 0;
+    if(!CACTI_METRICS && res.metrics_dump_usec > 0){
+        fprintf(stderr, "Warning: rejected request to dump metrics, which are not compiled in\n");
+        res.metrics_dump_usec = 0;
+    }
+    if(!CACTI_TRACE && res.trace_path != NULL){
+        fprintf(stderr, "Warning: rejected request to write a trace, which is not compiled in\n");
+        res.trace_path = NULL;
+    }
+    return res;
+}
+
+// Frees a system which could not be started. Its working threads which were started already
+// are let through their start, to find it finished and exit.
+void abort_system(global_data_t* global_data){
+    pthread_mutex_lock(global_data->mutex);
+    global_data->finished = true;
+    pthread_mutex_unlock(global_data->mutex);
+    enable_start(global_data);
+    director_join(global_data);
+    if(global_data->config.stop_on_sigint) remove_interruptible(global_data);
+    destroy_system(global_data);
+    free(global_data);
+}
+
+int cacti_system_create(global_data_t** system, actor_id_t *actor, role_t *const role,
+                        const actor_system_config_t *config){
+    global_data_t* global_data = malloc(sizeof(global_data_t));
+    *system = global_data;
     pthread_attr_t* default_attributes = malloc(sizeof(pthread_attr_t));
     pthread_attr_init(default_attributes);
     pthread_attr_setdetachstate(default_attributes, PTHREAD_CREATE_JOINABLE);
-    pthread_t* thread_descriptors = malloc(POOL_SIZE * sizeof(pthread_t));
-    sigset_t sigint_set = new_sigint_set();
-    pthread_sigmask(SIG_BLOCK, &sigint_set, NULL);
-    pthread_t* temp_desc = malloc(sizeof(pthread_t));
-    initialize_global_data(&global_data);
-    actor_info* info = new_actor_info(role, 0);
-    global_data.actors->actors[0] = info;
-    int err;
-    global_data.thread_descriptors = thread_descriptors;
-    for(int i = 0; i < POOL_SIZE; ++i){
-        err = pthread_create(temp_desc, default_attributes, &working_thread, NULL);
-        thread_descriptors[i] = *temp_desc;
-        pthread_detach(*temp_desc);
-        if(err != 0) return err;
-    }
-    sort_descriptors(thread_descriptors);
-    free(temp_desc);
-    pthread_t director_id;
-    err = pthread_create(&director_id, default_attributes, &director, NULL);
-    if(err != 0){
-        destroy_system(&global_data);
+    actor_system_config_t normalized = normalize_config(config);
+    initialize_global_data(global_data, &normalized);
+    set_up_affinity(global_data);
+    if(normalized.stop_on_sigint) add_interruptible(global_data);
+    pthread_mutex_lock(global_data->mutex);
+    actor_id_t first_actor = actors_directory_reserve(global_data->actors);
+    actor_info* info = new_actor_info(global_data->slabs[global_data->pool_capacity], role, first_actor);
+    actors_directory_set(global_data->actors, info);
+    pthread_mutex_unlock(global_data->mutex);
+    int err = 0;
+    pthread_mutex_lock(global_data->mutex);
+    for(int i = 0; i < normalized.workers && err == 0; ++i){
+        err = start_thread(global_data);
     }
-    *actor = 0;
+    pthread_mutex_unlock(global_data->mutex);
+    if(err == 0) err = pthread_create(&global_data->director_id, default_attributes, &director, global_data);
     free(default_attributes);
-    global_data.director_id = director_id;
+    if(err != 0){
+        abort_system(global_data);
+        *system = NULL;
+        *actor = -1;
+        return err;
+    }
+    *actor = first_actor;
+    return 0;
+}
+
+int actor_system_create_with(actor_id_t *actor, role_t *const role, const actor_system_config_t *config){
+    global_data_t* global_data;
+    int err = cacti_system_create(&global_data, actor, role, config);
+    atomic_store(&default_system, global_data);
     return err;
 }
+
+int actor_system_create(actor_id_t *actor, role_t *const role){
+    actor_system_config_t config;
+    actor_system_default_config(&config);
+    config.workers = POOL_SIZE;
+    return actor_system_create_with(actor, role, &config);
+}
@@ -2,6 +2,7 @@
 #define CACTI_H
 
 #include <stddef.h>
+#include <stdbool.h>
 
 // The actor system's interface as provided in the task.
 // This file was NOT prepared by me.
@@ -20,10 +21,67 @@ typedef long message_type_t;
 #define CAST_LIMIT 1048576
 #endif
 
+// The default throughput quantum: how many messages of one actor a thread executes in a row,
+// and for how many microseconds (0 for no time limit), before moving on to other actors.
+#ifndef THROUGHPUT_MESSAGES
+#define THROUGHPUT_MESSAGES 16
+#endif
+
+#ifndef THROUGHPUT_USEC
+#define THROUGHPUT_USEC 0
+#endif
+
+// The default idle policy: how many rounds a thread out of work spins, and then how many
+// times it yields the CPU, before parking.
+#ifndef IDLE_SPINS
+#define IDLE_SPINS 1000
+#endif
+
+#ifndef IDLE_YIELDS
+#define IDLE_YIELDS 16
+#endif
+
+// The default cap of the run-next slot: how many times in a row a thread executes an actor
+// sent a message by the prompt it has just executed, before moving on to other actors.
+#ifndef RUN_NEXT_LIMIT
+#define RUN_NEXT_LIMIT 16
+#endif
+
+// The largest payload which send_message_inline copies into the receiver's queue.
+#ifndef MESSAGE_INLINE_SIZE
+#define MESSAGE_INLINE_SIZE 32
+#endif
+
+// The resolution of timers: delays are rounded up to whole ticks.
+#ifndef TIMER_TICK_USEC
+#define TIMER_TICK_USEC 1000
+#endif
+
+// The default limit of the blocking pool, whose threads are started as blocking prompts need them.
+#ifndef BLOCKING_WORKERS
+#define BLOCKING_WORKERS 64
+#endif
+
 #ifndef POOL_SIZE
 #define POOL_SIZE 3
 #endif
 
+// Runtime metrics are only collected with CACTI_METRICS set to 1. Otherwise the code collecting
+// them is compiled out, and the metrics functions return -1.
+#ifndef CACTI_METRICS
+#define CACTI_METRICS 0
+#endif
+
+// Likewise, events are only traced with CACTI_TRACE set to 1. Every thread keeps the latest
+// CACTI_TRACE_EVENTS of its events, older ones are overwritten.
+#ifndef CACTI_TRACE
+#define CACTI_TRACE 0
+#endif
+
+#ifndef CACTI_TRACE_EVENTS
+#define CACTI_TRACE_EVENTS 32768
+#endif
+
 typedef struct message
 {
     message_type_t message_type;
@@ -43,10 +101,280 @@ typedef struct role
     act_t *prompts;
 } role_t;
 
+// Creates the system with POOL_SIZE working threads.
 int actor_system_create(actor_id_t *actor, role_t *const role);
 
+// How the working threads are placed on CPUs.
+typedef enum{
+    CACTI_AFFINITY_NONE, // the kernel moves them freely
+    CACTI_AFFINITY_CPUS, // the thread in slot i is pinned to cpus[i % ncpus]
+    CACTI_AFFINITY_CORES // the threads are pinned to one hardware thread of every physical core in turn
+} cacti_affinity_t;
+
+typedef struct actor_system_config
+{
+    int workers; // threads started with the system, 0 for the number of online CPUs
+    bool elastic; // whether threads are added and removed depending on the load
+    int min_workers; // the elastic pool never shrinks below this
+    int max_workers; // the elastic pool never grows above this
+    size_t grow_depth; // a thread is added when no thread is idle and this many actors are queued
+    long idle_usec; // a thread idle for that long exits, unless the pool is at min_workers
+    int blocking_workers; // the most threads executing blocking prompts, idle ones exit after idle_usec
+    int idle_spins; // rounds a thread out of work spins looking for some, before yielding
+    int idle_yields; // times it then yields the CPU, before parking until woken up
+    int run_next_limit; // cap of the run-next slot, 0 to schedule every actor like any other; see below
+    size_t throughput_messages; // the throughput quantum the system starts with, see THROUGHPUT_MESSAGES
+    long throughput_usec;
+    cacti_affinity_t affinity;
+    const int *cpus; // for CACTI_AFFINITY_CPUS, copied when the system is created
+    int ncpus;
+    const act_t *blocking_prompts; // prompts which may block, copied when the system is created; see below
+    int nblocking_prompts;
+    bool stop_on_sigint; // SIGINT stops the system, dropping the messages it has not executed
+    long metrics_dump_usec; // how often the metrics are written out, 0 for never; see below
+    const char *metrics_dump_path; // the file they are appended to, NULL for stderr
+    const char *trace_path; // where the trace is written as the system finishes, NULL for nowhere
+} actor_system_config_t;
+
+// Fills the configuration with the defaults: a fixed pool with one thread per online CPU,
+// not pinned to them, which spin briefly before parking when out of work.
+// Spinning shortens the wakeup of a thread which gets work soon after running out of it, at
+// the cost of CPU time; with no spins and yields, idle threads park at once.
+// With pinned threads spanning several NUMA nodes, every actor has a home node: the one its
+// record was allocated on, by the thread which spawned it. Threads on its home node are
+// preferred to execute it.
+// Prompts which may block, e.g. on I/O or sleeping, are listed in blocking_prompts. Their
+// messages are executed by a separate pool of blocking threads, so that they do not hold up
+// the working threads meanwhile; an actor still executes one message at a time.
+// An actor which a prompt sends a message to, and which was not scheduled yet, is executed by
+// the same thread right after that prompt's actor, while the message is still in its cache,
+// unless the prompt sends to yet another such actor: only the last one is kept there. So
+// request and response alternate on one thread, instead of waking up others. An actor kept
+// there cannot be stolen meanwhile, and after run_next_limit of them in a row the next one
+// is queued behind the rest instead, so that actors sending to each other do not starve them.
+void actor_system_default_config(actor_system_config_t *config);
+
+int actor_system_create_with(actor_id_t *actor, role_t *const role, const actor_system_config_t *config);
+
+// A system finishes once all its actors are dead and have executed their messages.
+// SIGINT is left alone, unless stop_on_sigint is set: then a handler is installed for it.
+
+// Waits for the default system to finish, then frees it, so that a new one may be created.
+// To wait for a single actor while the system goes on, use cacti_actor_join.
 void actor_system_join(actor_id_t actor);
 
+// Several independent systems may run in one process, each with its own threads, queues
+// and actors. Actor IDs only mean something within the system which handed them out.
+// The functions without a system handle act on the system executing the calling prompt,
+// or, outside the working threads, on the default system made by actor_system_create.
+// Before it is created and once it has been joined, they return -2, or NULL for pointers
+// (-1 for actor_id_self). While it is being joined, sends to it return -1.
+typedef struct actor_system_s actor_system_t;
+
+// Creates a new system next to the default one, and its first actor. Returns 0, or the error
+// of a thread which could not be started: then nothing is left of the system, *system is NULL
+// and *actor is -1.
+int cacti_system_create(actor_system_t **system, actor_id_t *actor, role_t *const role,
+                        const actor_system_config_t *config);
+
+// Waits for the system to finish, then frees it, so the handle may not be used afterwards.
+void cacti_system_join(actor_system_t *system, actor_id_t actor);
+
+// The system executing the calling prompt, or the default one outside the working threads.
+actor_system_t *cacti_system_current();
+
+// Any thread may send to any system, but only until it finishes. Pool buffers may be passed
+// between systems too, as long as they are freed before the one they come from finishes.
+int cacti_send_message(actor_system_t *system, actor_id_t actor, message_t message);
+
+// Waits for the actor to die and execute its last message, while the system goes on.
+// May not be called from the system's own prompts.
+void cacti_actor_join(actor_system_t *system, actor_id_t actor);
+
+// Returns -1 unless called from a prompt executed by the given system.
+actor_id_t cacti_actor_id_self(actor_system_t *system);
+
+// MSG_GODIE and MSG_SPAWN skip the actor's queue: they are executed before the messages
+// waiting there, in the order in which they were sent. A dead actor still executes the
+// messages sent before its death, so GODIE does not make an actor with a backlog finish any
+// sooner: it only makes later sends to it fail at once.
 int send_message(actor_id_t actor, message_t message);
 
+// Like send_message, but the message skips the actor's queue like a system message.
+// The priority lane is unbounded, so it never returns -3.
+int send_message_priority(actor_id_t actor, message_t message);
+
+// Like send_message, but if the actor's queue is full, waits until there is room instead of
+// returning -3, so that an overloaded receiver slows its senders down. Inside a prompt it
+// never blocks the working thread: the message is deferred and 0 returned, and the calling
+// actor executes no further messages until its deferred ones are delivered. Deferred messages
+// keep their order, but a plain send_message may overtake them. A blocking prompt simply waits,
+// as it holds up no working thread. Two actors waiting for room in each other's queues wait
+// forever.
+int send_message_wait(actor_id_t actor, message_t message);
+
+// Like send_message_wait, but gives up after timeout_usec microseconds and returns -3.
+// A deferred message which is not delivered in time is dropped with a warning.
+int send_message_timed(actor_id_t actor, message_t message, long timeout_usec);
+
+// Appends the messages to the actor's queue in order, with no other message in between,
+// and schedules the actor once. System messages among them go to the priority lane.
+// If not all of them fit, only a prefix is sent: returns how many, possibly 0 for a full
+// queue, or -1 and -2 like send_message.
+int send_messages(actor_id_t actor, message_t *messages, size_t count);
+
+// Sends a message whose payload of at most MESSAGE_INLINE_SIZE bytes is copied into the
+// actor's queue, so neither the sender nor the receiver allocates anything. The prompt gets
+// a pointer to a copy which is valid until it returns, and must not free it.
+// Returns -4 for a larger payload, or for MSG_SPAWN, whose role is always passed by pointer.
+int send_message_inline(actor_id_t actor, message_type_t message_type, const void *payload, size_t nbytes);
+
+typedef long timer_id_t;
+
+// Sends the message to the actor once delay_usec microseconds have passed, rounded up to
+// whole ticks of TIMER_TICK_USEC. The system's timer thread sends it, so no working thread
+// waits meanwhile. Returns an ID for cancel_timer, or -1 and -2 like send_message. If the
+// actor's queue is full when the timer fires, the message is tried again with every tick.
+timer_id_t send_message_after(actor_id_t actor, message_t message, long delay_usec);
+
+// Like send_message_after, but then sends the message again every period_usec microseconds,
+// until the timer is cancelled or the actor dies. A period in which the actor's queue is
+// full is skipped with a warning. Every time the prompt gets the same data,
+// which the system never frees. Returns -4 for MSG_SPAWN, whose role may only be used once.
+timer_id_t send_message_every(actor_id_t actor, message_t message, long delay_usec, long period_usec);
+
+// Returns 0 if the timer is cancelled before firing, or the periodic timer before firing
+// again, and -1 if it has fired already or does not exist. A message being sent as the timer
+// is cancelled may still arrive. A cancelled timer's data is the caller's again.
+// Timers belong to the system they were started in, like actors.
+int cancel_timer(timer_id_t timer);
+
+// The readiness of a file descriptor, as reported by the reactor.
+#define CACTI_IO_READABLE 1
+#define CACTI_IO_WRITABLE 2
+#define CACTI_IO_CLOSED 4 // hung up or failed, reported even if not asked for
+
+// The payload of an I/O event, copied into the actor's queue like with send_message_inline.
+typedef struct cacti_io_event
+{
+    int fd;
+    int events;
+} cacti_io_event_t;
+
+// Has the system's reactor thread send the actor a message of the given type once the
+// descriptor, which should be non-blocking, is ready for any of the events: CACTI_IO_READABLE
+// and CACTI_IO_WRITABLE. The prompt gets a cacti_io_event_t. A watch is one-shot: the
+// descriptor is watched again only once cacti_io_watch is called again, usually by the prompt
+// which has handled the event, so the actor never gets a backlog of stale events. Watching a
+// watched descriptor replaces its watch. After a CACTI_IO_CLOSED event the descriptor is no
+// longer watched. If the actor's queue is full, the event is sent once there is room, and if
+// the actor is dead, the watch is dropped. Returns -1 and -2 like send_message, or -4 for
+// MSG_SPAWN and MSG_GODIE, for no events, or for a descriptor epoll does not take.
+// Descriptors are watched by the system they were watched in, like timers.
+int cacti_io_watch(actor_id_t actor, int fd, int events, message_type_t message_type);
+
+// Has to be called before a watched descriptor is closed. Returns 0 if it was watched,
+// -1 otherwise. An event being sent as the watch is dropped may still arrive.
+int cacti_io_unwatch(int fd);
+
+typedef struct actor_group actor_group_t;
+
+// A set of actors to multicast messages to. Groups are destroyed explicitly, and members
+// which die are dropped by the next multicast. A group may be used from any thread, and
+// belongs to the system it was created in.
+actor_group_t *actor_group_create();
+
+actor_group_t *cacti_group_create(actor_system_t *system);
+
+void actor_group_destroy(actor_group_t *group);
+
+// Returns -2 if the actor does not exist. Adding a member twice has no effect.
+int actor_group_add(actor_group_t *group, actor_id_t actor);
+
+// Returns -1 if the actor is not a member.
+int actor_group_remove(actor_group_t *group, actor_id_t actor);
+
+// Delivers the message to every live member of the group. The payload is copied once, into
+// a buffer shared by all the receivers; the prompts get pointers to it which are valid until
+// they return, and must neither modify nor free it. The members are scheduled together,
+// with one wakeup of the idle threads. Returns the number of members the message was
+// delivered to, or -4 for MSG_SPAWN.
+int send_to_group(actor_group_t *group, message_type_t message_type, const void *payload, size_t nbytes);
+
+// Allocates a buffer for a message payload from a pool of the calling working thread.
+// Any thread may free it with cacti_msg_free, usually the receiver once it is done with
+// the payload, and it returns to the pool it came from without any global lock.
+// Outside the working threads, and above a few kilobytes, it falls back to malloc.
+// The buffers have to be freed before the system finishes.
+void *cacti_msg_alloc(size_t nbytes);
+
+void cacti_msg_free(void *buffer);
+
+// Changes the throughput quantum of the system, may be called at any time. A thread always
+// executes at least one message per actor activation.
+void cacti_system_set_throughput(actor_system_t *system, size_t messages, long usec);
+
+// The same for the current system, see above; without one it does nothing.
+void actor_system_set_throughput(size_t messages, long usec);
+
+// Latencies are counted in buckets of powers of two: bucket i holds those of [2^i, 2^(i+1))
+// nanoseconds, the first one also 0, and the last one everything longer.
+#define CACTI_METRICS_BUCKETS 40
+
+// Prompts from CACTI_METRICS_PROMPTS up share the last histogram with the system messages.
+#define CACTI_METRICS_PROMPTS 16
+
+typedef struct cacti_histogram
+{
+    unsigned long counts[CACTI_METRICS_BUCKETS];
+} cacti_histogram_t;
+
+typedef struct cacti_worker_metrics
+{
+    unsigned long messages; // executed
+    unsigned long activations; // times an actor was taken up to execute its messages
+    unsigned long steals; // actors taken from the deques of other threads
+    unsigned long parks; // times the thread went to sleep for lack of work
+    unsigned long idle_usec; // time spent spinning, yielding and asleep
+} cacti_worker_metrics_t;
+
+typedef struct cacti_metrics
+{
+    cacti_worker_metrics_t total;
+    int nworkers;
+    cacti_worker_metrics_t *workers; // one per working thread slot, then one for all the blocking threads
+    cacti_histogram_t queue_wait[CACTI_METRICS_PROMPTS + 1]; // from sending a message to starting its prompt
+    cacti_histogram_t run_time[CACTI_METRICS_PROMPTS + 1]; // of the prompt
+} cacti_metrics_t;
+
+// Sums up the metrics of all the threads the system has had so far. Every thread counts its
+// own, so the snapshot is not taken at a single point in time while the system runs.
+// The workers array is allocated, and freed with cacti_metrics_release.
+// With metrics_dump_usec set, the system writes a summary of its metrics out that often,
+// and once more as it finishes.
+int cacti_metrics_snapshot(actor_system_t *system, cacti_metrics_t *metrics);
+
+void cacti_metrics_release(cacti_metrics_t *metrics);
+
+// The upper bound of the bucket in which the given quantile, between 0 and 1, falls,
+// or 0 for an empty histogram.
+unsigned long cacti_histogram_quantile(const cacti_histogram_t *histogram, double quantile);
+
+typedef struct cacti_actor_metrics
+{
+    size_t depth; // messages in the queue, not counting the priority lane
+    size_t high_water; // the most there have ever been
+    unsigned long messages; // executed so far
+} cacti_actor_metrics_t;
+
+// Returns -2 if the actor does not exist, and -1 once it is reclaimed, like send_message.
+int cacti_actor_metrics(actor_system_t *system, actor_id_t actor, cacti_actor_metrics_t *metrics);
+
+// Writes the events traced since the last flush to the file, in the trace event format which
+// Perfetto and chrome://tracing load: every thread is a track on which the prompts it has
+// executed are slices, and sends, enqueues, spawns and deaths are instant events. Timestamps
+// are in microseconds since the system was created. A flush while the system runs drops the
+// events which are being overwritten meanwhile. Returns -1 if the file cannot be written.
+int cacti_trace_flush(actor_system_t *system, const char *path);
+
 #endif
\ No newline at end of file
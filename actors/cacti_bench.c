@@ -0,0 +1,1734 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "cacti.h"
+
+// Benchmarks of the actor system. Usage:
+// ./cacti_bench [-t threads] [-e max threads] [-n actors] [-m messages per actor]
+//               [-i iterations per message] [-q quantum messages] [-u quantum microseconds]
+//               [-c cores|cpu,cpu,...] [-d dump microseconds] [-T trace file] [-r run-next limit]
+//               [-p|-P] [-b] [-g] [-k] [workload]
+// With -e the pool is elastic, starting with the given number of threads. With -c the threads
+// are pinned to one hardware thread of every physical core, or to the listed CPUs. With -d
+// a system built with CACTI_METRICS writes its metrics to stderr that often, and with -T one built
+// with CACTI_TRACE writes its trace to the file as it finishes. -r 0 turns the run-next slot
+// off. The workloads:
+// fanout - the first actor spawns n workers and keeps a fixed window of messages in flight
+//          to each of them. Every worker does a bit of computation per message and reports
+//          back, so the run is bound by how well the scheduler spreads the workers over the
+//          threads. This is the default.
+// idle   - n actors are spawned and left without messages, to measure the memory they take.
+// spawn  - the first actor spawns n spawners, each of which spawns m short-lived children one
+//          after another, sends every child a message and waits for it. All the spawners run
+//          at once, so the run measures spawning and sending from many threads.
+// pingpong - two actors bounce a small message m times. With -p its payload is allocated by
+//          the sender with malloc and freed by the receiver, with -P it comes from the message
+//          pools, otherwise it is copied into the mailbox.
+// bulk   - an actor sends m messages to another one, in bursts of half its queue, waiting for
+//          each burst to be received. With -b every burst is sent with one send_messages call,
+//          otherwise message by message.
+// multicast - the first actor spawns n members and sends them m events of 32 bytes, a window
+//          of them at a time. With -g every event is sent with send_to_group, otherwise with
+//          a loop of send_message_inline calls.
+//          Reports the allocations made per message while the ball is in play.
+// priority - m rounds, in each of which main fills an actor's queue halfway with messages
+//          doing i iterations of computation, then sends a few probes: with
+//          send_message_priority in even rounds, with send_message in odd ones. Reports how
+//          long the first probe waited with either, and checks that both lanes keep their
+//          order. Finally the actor gets a GODIE behind a backlog, which it still executes.
+//          Fails if a priority message does not overtake the backlog, or a lane loses its order.
+// shards - n independent actor systems of t threads each, in each of which an actor sends
+//          itself m messages one after another. Then every system passes a token allocated
+//          from its message pools to the next one, which frees it and acknowledges it.
+//          Once all are done, main ends the systems, so none of them is sent anything after
+//          it finishes.
+// latency - main sends an actor m requests one at a time, each once the previous one has
+//          been answered, and reports the p50 and p99 round trip. It is run once for every
+//          idle policy: parking at once, yielding before parking, and the default of spinning,
+//          then yielding, then parking.
+// timers - main starts m timers for an actor, with delays spread evenly over 100 ms, and
+//          reports how late they fire: the p50, the p99, and the earliest, which is never
+//          negative.
+// jobs   - m short jobs one after another, each a new system whose only actor is sent one
+//          message and dies, joined before the next one is created. Reports the p50 and p99
+//          time from creating a system to having joined it.
+// blocking - the first actor spawns n sleepers, each of which executes m messages sleeping
+//          for a millisecond, and gets a tick from a periodic timer every millisecond until they
+//          are all done. Reports the longest gap between the ticks it executed. The sleeping
+//          prompt is flagged as blocking, unless -k keeps it on the working threads.
+// chain  - a chain of n actors, each spawned by the one before it, passes one message from its
+//          first actor to its last one, which tells main.
+// skynet - every actor spawns ten children, down to a depth of log10(n) levels, and the
+//          leaves send their numbers back up to be summed. Checks the sum.
+// mpsc   - n producers send m messages each to one consumer, with send_message_wait, so the
+//          consumer's queue stays full.
+// pipeline - m rows flow through n column actors, each of which does a bit of computation
+//          per row and passes it on to the next column. Checks the sums of the rows.
+// suite  - pingpong, fanout, chain, skynet, mpsc and pipeline, each in a process of its own.
+// fanout, pingpong, chain, skynet, mpsc and pipeline end with one line of key=value pairs:
+// messages, seconds, msgs_per_sec, the p50 and p99 latency of the messages sampled, in
+// microseconds, and peak_rss_kb.
+
+// The replies of all the workers have to fit in the first actor's queue.
+#define FANOUT_IN_FLIGHT (ACTOR_QUEUE_LIMIT / 2)
+
+int fanout_workers = 64; // at most FANOUT_IN_FLIGHT
+long idle_actors = 1000000;
+long fanout_messages = 2000;
+long fanout_iterations = 2000;
+int spawn_spawners = 64;
+long spawn_children = 2000;
+long pingpong_messages = 1000000;
+enum { PAYLOAD_INLINE, PAYLOAD_MALLOC, PAYLOAD_POOL } pingpong_payload = PAYLOAD_INLINE;
+const char* payload_names[] = {"inline", "malloc", "pool"};
+long bulk_messages = 1000000;
+bool bulk_batched = false;
+int multicast_members = 256;
+long multicast_events = 2000;
+bool multicast_grouped = false;
+long priority_rounds = 200;
+int shard_systems = 4;
+long shard_messages = 1000000;
+long latency_rounds = 20000;
+long job_count = 2000;
+long timer_count = 10000;
+int blocking_sleepers = 64;
+long blocking_sleeps = 20;
+bool blocking_flagged = true;
+long chain_links = 100000;
+int skynet_depth = 6;
+int mpsc_producers = 64;
+long mpsc_messages = 20000;
+int pipeline_columns = 64;
+long pipeline_rows = 10000;
+actor_system_config_t config;
+
+// Latency samples of the workload being run, in microseconds, recorded by any thread.
+// Workloads with many cheap messages only sample every LATENCY_SAMPLE_EVERY-th of them,
+// so that reading the clock does not weigh on their throughput.
+#define LATENCY_SAMPLES (1 << 20)
+#define LATENCY_SAMPLE_EVERY 16
+
+double latency_samples[LATENCY_SAMPLES];
+atomic_long latency_count;
+
+double now_usec(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+void record_latency(double usec){
+    long index = atomic_fetch_add_explicit(&latency_count, 1, memory_order_relaxed);
+    if(index < LATENCY_SAMPLES) latency_samples[index] = usec;
+}
+
+typedef struct{
+    actor_id_t* workers;
+    long* remaining;
+    int registered;
+    long unfinished;
+} fanout_root_state;
+
+void fanout_hello(void **stateptr, size_t nbytes, void* data);
+
+void fanout_register(void **stateptr, size_t nbytes, void* data);
+
+void fanout_work(void **stateptr, size_t nbytes, void* data);
+
+void fanout_done(void **stateptr, size_t nbytes, void* data);
+
+// Roles are freed together with their actors, so every actor needs its own.
+role_t* new_fanout_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 4;
+    void** prompts = malloc(4 * sizeof(act_t));
+    prompts[0] = &fanout_hello;
+    prompts[1] = &fanout_register;
+    prompts[2] = &fanout_work;
+    prompts[3] = &fanout_done;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+message_t new_fanout_message(message_type_t type, intptr_t value){
+    message_t res;
+    res.message_type = type;
+    res.nbytes = sizeof(void*);
+    res.data = (void*) value;
+    return res;
+}
+
+message_t new_godie(){
+    message_t res;
+    res.message_type = MSG_GODIE;
+    res.nbytes = 0;
+    res.data = NULL;
+    return res;
+}
+
+// A request carries the index of its worker, which sends it back as the reply, and on every
+// LATENCY_SAMPLE_EVERY-th request also when it was sent.
+typedef struct{
+    long index;
+    double sent;
+} fanout_request;
+
+void send_fanout_work(fanout_root_state* state, int index){
+    state->remaining[index] -= 1;
+    fanout_request request = {index, state->remaining[index] % LATENCY_SAMPLE_EVERY == 0 ? now_usec() : 0};
+    send_message_inline(state->workers[index], 2, &request, sizeof(fanout_request));
+}
+
+// The first actor gets a hello with no data from main and spawns the workers,
+// a spawned worker gets the id of its father and registers with it.
+void fanout_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        fanout_root_state* state = malloc(sizeof(fanout_root_state));
+        state->workers = malloc(fanout_workers * sizeof(actor_id_t));
+        state->remaining = malloc(fanout_workers * sizeof(long));
+        state->registered = 0;
+        state->unfinished = fanout_workers * fanout_messages;
+        *stateptr = state;
+        message_t spawn;
+        spawn.message_type = MSG_SPAWN;
+        spawn.nbytes = sizeof(role_t*);
+        for(int i = 0; i < fanout_workers; i++){
+            spawn.data = new_fanout_role();
+            send_message(actor_id_self(), spawn);
+        }
+    }
+    else{
+        actor_id_t father = *((actor_id_t*) data);
+        free(data);
+        send_message(father, new_fanout_message(1, actor_id_self()));
+    }
+}
+
+void fanout_register(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    fanout_root_state* state = *stateptr;
+    int index = state->registered++;
+    state->workers[index] = (actor_id_t) (intptr_t) data;
+    state->remaining[index] = fanout_messages;
+    int window = FANOUT_IN_FLIGHT / fanout_workers;
+    for(int i = 0; i < window && state->remaining[index] > 0; i++){
+        send_fanout_work(state, index);
+    }
+}
+
+void fanout_work(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    volatile unsigned long accumulator = 0;
+    for(long i = 0; i < fanout_iterations; i++){
+        accumulator += i * i;
+    }
+    send_message_inline(0, 3, data, sizeof(fanout_request));
+}
+
+void fanout_done(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    fanout_root_state* state = *stateptr;
+    fanout_request* reply = data;
+    int index = (int) reply->index;
+    if(reply->sent > 0) record_latency(now_usec() - reply->sent);
+    state->unfinished -= 1;
+    if(state->remaining[index] > 0){
+        send_fanout_work(state, index);
+    }
+    if(state->unfinished == 0){
+        for(int i = 0; i < fanout_workers; i++){
+            send_message(state->workers[i], new_godie());
+        }
+        free(state->workers);
+        free(state->remaining);
+        free(state);
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+// The idle actors spawn each other in a binary tree, until there are enough of them.
+atomic_long idle_spawned;
+atomic_long idle_ready;
+
+void idle_hello(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_idle_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 1;
+    void** prompts = malloc(sizeof(act_t));
+    prompts[0] = &idle_hello;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+void idle_hello(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    free(data);
+    message_t spawn;
+    spawn.message_type = MSG_SPAWN;
+    spawn.nbytes = sizeof(role_t*);
+    for(int i = 0; i < 2; i++){
+        if(atomic_fetch_add(&idle_spawned, 1) < idle_actors){
+            spawn.data = new_idle_role();
+            send_message(actor_id_self(), spawn);
+        }
+    }
+    atomic_fetch_add(&idle_ready, 1);
+}
+
+// The first actor spawns the spawners and dies, a spawner spawns its children one by one.
+// A child tells its father its id, gets a message back and dies.
+void spawn_root_hello(void **stateptr, size_t nbytes, void* data);
+
+void spawner_hello(void **stateptr, size_t nbytes, void* data);
+
+void spawner_child_ready(void **stateptr, size_t nbytes, void* data);
+
+void spawn_child_hello(void **stateptr, size_t nbytes, void* data);
+
+void spawn_child_ping(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_spawn_role(act_t hello, act_t second){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 2;
+    void** prompts = malloc(2 * sizeof(act_t));
+    prompts[0] = hello;
+    prompts[1] = second;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+message_t new_spawn(role_t* role){
+    message_t res;
+    res.message_type = MSG_SPAWN;
+    res.nbytes = sizeof(role_t*);
+    res.data = role;
+    return res;
+}
+
+void spawn_root_hello(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    for(int i = 0; i < spawn_spawners; i++){
+        send_message(actor_id_self(), new_spawn(new_spawn_role(&spawner_hello, &spawner_child_ready)));
+    }
+    send_message(actor_id_self(), new_godie());
+}
+
+void spawner_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    free(data);
+    *stateptr = (void*) (intptr_t) spawn_children;
+    send_message(actor_id_self(), new_spawn(new_spawn_role(&spawn_child_hello, &spawn_child_ping)));
+}
+
+void spawner_child_ready(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    send_message((actor_id_t) (intptr_t) data, new_fanout_message(1, 0));
+    intptr_t remaining = (intptr_t) *stateptr - 1;
+    *stateptr = (void*) remaining;
+    if(remaining > 0){
+        send_message(actor_id_self(), new_spawn(new_spawn_role(&spawn_child_hello, &spawn_child_ping)));
+    }
+    else{
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+void spawn_child_hello(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    actor_id_t father = *((actor_id_t*) data);
+    free(data);
+    send_message(father, new_fanout_message(1, actor_id_self()));
+}
+
+void spawn_child_ping(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    send_message(actor_id_self(), new_godie());
+}
+
+// Allocations are counted by wrapping the allocator of glibc, elsewhere they read as 0.
+// The sanitizers wrap it themselves.
+atomic_long allocations;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size){
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+#endif
+
+// The first actor spawns its partner, which serves the ball. Whoever receives the last ball
+// ends the game.
+typedef struct{
+    actor_id_t from;
+    long remaining;
+    double sent; // on every LATENCY_SAMPLE_EVERY-th ball, 0 on the others
+    long padding; // makes the payload as large as fits inline
+} pingpong_ball;
+
+long pingpong_allocations_before;
+long pingpong_allocations_after;
+
+void pingpong_hello(void **stateptr, size_t nbytes, void* data);
+
+void pingpong_receive(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_pingpong_role(){
+    return new_spawn_role(&pingpong_hello, &pingpong_receive);
+}
+
+void pingpong_send(actor_id_t actor, long remaining){
+    pingpong_ball ball = {actor_id_self(), remaining, remaining % LATENCY_SAMPLE_EVERY == 0 ? now_usec() : 0, 0};
+    if(pingpong_payload == PAYLOAD_INLINE){
+        send_message_inline(actor, 1, &ball, sizeof(pingpong_ball));
+        return;
+    }
+    pingpong_ball* copy = pingpong_payload == PAYLOAD_POOL ? cacti_msg_alloc(sizeof(pingpong_ball))
+                                                           : malloc(sizeof(pingpong_ball));
+    *copy = ball;
+    send_message(actor, new_fanout_message(1, (intptr_t) copy));
+}
+
+void pingpong_hello(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    if(data == NULL){
+        send_message(actor_id_self(), new_spawn(new_pingpong_role()));
+    }
+    else{
+        actor_id_t father = *((actor_id_t*) data);
+        free(data);
+        pingpong_allocations_before = atomic_load(&allocations);
+        pingpong_send(father, pingpong_messages - 1);
+    }
+}
+
+void pingpong_receive(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    pingpong_ball ball = *((pingpong_ball*) data);
+    if(ball.sent > 0) record_latency(now_usec() - ball.sent);
+    if(pingpong_payload == PAYLOAD_MALLOC) free(data);
+    else if(pingpong_payload == PAYLOAD_POOL) cacti_msg_free(data);
+    if(ball.remaining > 0){
+        pingpong_send(ball.from, ball.remaining - 1);
+    }
+    else{
+        pingpong_allocations_after = atomic_load(&allocations);
+        send_message(ball.from, new_godie());
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+// The producer is the first actor, it spawns the consumer, which asks for the first burst.
+// The consumer asks for the next one whenever it has received a whole burst.
+#define BULK_BURST (ACTOR_QUEUE_LIMIT / 2)
+
+message_t bulk_burst[BULK_BURST];
+long bulk_sent;
+long bulk_received;
+
+void bulk_hello(void **stateptr, size_t nbytes, void* data);
+
+void bulk_produce(void **stateptr, size_t nbytes, void* data);
+
+void bulk_consume(void **stateptr, size_t nbytes, void* data);
+
+void bulk_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        for(int i = 0; i < BULK_BURST; i++) bulk_burst[i] = new_fanout_message(1, i);
+        send_message(actor_id_self(), new_spawn(new_spawn_role(&bulk_hello, &bulk_consume)));
+    }
+    else{
+        actor_id_t father = *((actor_id_t*) data);
+        free(data);
+        *stateptr = (void*) (intptr_t) father;
+        send_message(father, new_fanout_message(1, actor_id_self()));
+    }
+}
+
+void bulk_produce(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    actor_id_t consumer = (actor_id_t) (intptr_t) data;
+    long burst = bulk_messages - bulk_sent;
+    if(burst == 0){
+        send_message(consumer, new_godie());
+        send_message(actor_id_self(), new_godie());
+        return;
+    }
+    if(burst > BULK_BURST) burst = BULK_BURST;
+    if(bulk_batched){
+        send_messages(consumer, bulk_burst, burst);
+    }
+    else{
+        for(long i = 0; i < burst; i++) send_message(consumer, bulk_burst[i]);
+    }
+    bulk_sent += burst;
+}
+
+void bulk_consume(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    bulk_received += 1;
+    if(bulk_received % BULK_BURST == 0 || bulk_received == bulk_messages){
+        send_message((actor_id_t) (intptr_t) *stateptr, new_fanout_message(1, actor_id_self()));
+    }
+}
+
+// The members register with the first actor, which then creates the group. The member
+// which makes the last delivery of a window asks the first actor for the next window.
+#define MULTICAST_WINDOW 64
+
+typedef struct{
+    long sequence;
+    long padding[3];
+} multicast_event;
+
+actor_group_t* multicast_group;
+actor_id_t* multicast_member_ids;
+int multicast_registered;
+long multicast_sent;
+atomic_long multicast_received;
+
+void multicast_hello(void **stateptr, size_t nbytes, void* data);
+
+void multicast_root(void **stateptr, size_t nbytes, void* data);
+
+void multicast_member(void **stateptr, size_t nbytes, void* data);
+
+void multicast_send(message_type_t type, const void* payload, size_t nbytes){
+    if(multicast_grouped){
+        send_to_group(multicast_group, type, payload, nbytes);
+    }
+    else{
+        for(int i = 0; i < multicast_members; i++){
+            send_message_inline(multicast_member_ids[i], type, payload, nbytes);
+        }
+    }
+}
+
+void multicast_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        multicast_group = actor_group_create();
+        multicast_member_ids = malloc(multicast_members * sizeof(actor_id_t));
+        for(int i = 0; i < multicast_members; i++){
+            send_message(actor_id_self(), new_spawn(new_spawn_role(&multicast_hello, &multicast_member)));
+        }
+    }
+    else{
+        actor_id_t father = *((actor_id_t*) data);
+        free(data);
+        *stateptr = (void*) (intptr_t) father;
+        send_message(father, new_fanout_message(1, actor_id_self()));
+    }
+}
+
+void multicast_root(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    if(multicast_registered < multicast_members){
+        multicast_member_ids[multicast_registered++] = (actor_id_t) (intptr_t) data;
+        actor_group_add(multicast_group, (actor_id_t) (intptr_t) data);
+        if(multicast_registered < multicast_members) return;
+    }
+    if(multicast_sent == multicast_events){
+        multicast_send(MSG_GODIE, NULL, 0);
+        send_message(actor_id_self(), new_godie());
+        return;
+    }
+    multicast_event event = {0, {0, 0, 0}};
+    for(int i = 0; i < MULTICAST_WINDOW && multicast_sent < multicast_events; i++){
+        event.sequence = multicast_sent++;
+        multicast_send(1, &event, sizeof(multicast_event));
+    }
+}
+
+void multicast_member(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    long received = atomic_fetch_add(&multicast_received, 1) + 1;
+    if(received % (MULTICAST_WINDOW * multicast_members) == 0 ||
+            received == multicast_events * multicast_members){
+        send_message((actor_id_t) (intptr_t) *stateptr, new_fanout_message(1, 0));
+    }
+}
+
+#define PRIORITY_BACKLOG (ACTOR_QUEUE_LIMIT / 2)
+#define PRIORITY_PROBES 4
+
+atomic_long priority_backlog_received;
+atomic_long priority_probes_received;
+atomic_long priority_released; // rounds whose probes, or the final GODIE, have been sent
+long priority_order_errors;
+struct timespec* priority_sent; // when the first probe of every round was sent
+double* priority_latencies; // how long it waited, in microseconds
+
+double seconds_since(struct timespec* start);
+
+void priority_backlog(void **stateptr, size_t nbytes, void* data);
+
+void priority_probe(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_priority_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 2;
+    void** prompts = malloc(2 * sizeof(act_t));
+    prompts[0] = &priority_backlog;
+    prompts[1] = &priority_probe;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+// The first message of the backlog of a round with priority probes, and of the final one,
+// holds the actor until they are sent, so they find the rest of the backlog still queued.
+// The next one sees the actor dead already, if the final GODIE has overtaken it.
+void priority_backlog(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    long sequence = (long) (intptr_t) data;
+    long round = sequence / PRIORITY_BACKLOG;
+    if(sequence % PRIORITY_BACKLOG == 0 && (round % 2 == 0 || round == priority_rounds)){
+        while(atomic_load(&priority_released) <= round) sched_yield();
+    }
+    if(sequence % PRIORITY_BACKLOG == 1 && round == priority_rounds){
+        if(send_message(actor_id_self(), new_godie()) != -1) priority_order_errors += 1;
+    }
+    volatile unsigned long accumulator = 0;
+    for(long i = 0; i < fanout_iterations; i++){
+        accumulator += i * i;
+    }
+    if(sequence != atomic_load(&priority_backlog_received)) priority_order_errors += 1;
+    atomic_fetch_add(&priority_backlog_received, 1);
+}
+
+void priority_probe(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    long sequence = (long) (intptr_t) data;
+    long round = sequence / PRIORITY_PROBES;
+    if(sequence != atomic_load(&priority_probes_received)) priority_order_errors += 1;
+    if(round % 2 == 0 && atomic_load(&priority_backlog_received) > round * PRIORITY_BACKLOG + 1){
+        priority_order_errors += 1;
+    }
+    if(sequence % PRIORITY_PROBES == 0){
+        priority_latencies[round] = seconds_since(&priority_sent[round]) * 1e6;
+    }
+    atomic_fetch_add(&priority_probes_received, 1);
+}
+
+int compare_doubles(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts every other latency, starting from the given round, and returns the median.
+double median_of_rounds(long first, double* max){
+    long count = (priority_rounds - first + 1) / 2;
+    double* latencies = malloc((count > 0 ? count : 1) * sizeof(double));
+    for(long i = 0; i < count; i++) latencies[i] = priority_latencies[first + 2 * i];
+    qsort(latencies, count, sizeof(double), &compare_doubles);
+    double res = count > 0 ? latencies[count / 2] : 0;
+    *max = count > 0 ? latencies[count - 1] : 0;
+    free(latencies);
+    return res;
+}
+
+actor_system_t** shards;
+actor_id_t* shard_roots;
+atomic_int shards_done;
+
+// The token from the previous system may arrive before the actor is done bouncing, or even
+// before it starts, so it is done once all has happened. Its own token has to be
+// acknowledged too, as the buffer returns to the system's pool, which is gone once
+// the system finishes.
+typedef struct{
+    int index;
+    bool bounced;
+    bool token;
+    bool acknowledged;
+} shard_state;
+
+void shard_hello(void **stateptr, size_t nbytes, void* data);
+
+void shard_bounce(void **stateptr, size_t nbytes, void* data);
+
+void shard_token(void **stateptr, size_t nbytes, void* data);
+
+void shard_ack(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_shard_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 4;
+    void** prompts = malloc(4 * sizeof(act_t));
+    prompts[0] = &shard_hello;
+    prompts[1] = &shard_bounce;
+    prompts[2] = &shard_token;
+    prompts[3] = &shard_ack;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+shard_state* shard_state_of(void **stateptr){
+    if(*stateptr == NULL){
+        shard_state* state = malloc(sizeof(shard_state));
+        state->index = 0;
+        while(shards[state->index] != cacti_system_current()) state->index++;
+        state->bounced = false;
+        state->token = false;
+        state->acknowledged = false;
+        *stateptr = state;
+    }
+    return *stateptr;
+}
+
+void shard_done(void **stateptr){
+    shard_state* state = *stateptr;
+    if(!state->bounced || !state->token || !state->acknowledged) return;
+    free(state);
+    *stateptr = NULL;
+    atomic_fetch_add(&shards_done, 1);
+}
+
+void shard_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    shard_state_of(stateptr);
+    send_message_inline(actor_id_self(), 1, &shard_messages, sizeof(long));
+}
+
+void shard_bounce(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    long remaining = *((long*) data);
+    if(remaining > 0){
+        remaining -= 1;
+        send_message_inline(actor_id_self(), 1, &remaining, sizeof(long));
+        return;
+    }
+    shard_state* state = shard_state_of(stateptr);
+    int next = (state->index + 1) % shard_systems;
+    long* token = cacti_msg_alloc(sizeof(long));
+    *token = next;
+    message_t message = new_fanout_message(2, 0);
+    message.data = token;
+    cacti_send_message(shards[next], shard_roots[next], message);
+    state->bounced = true;
+    shard_done(stateptr);
+}
+
+void shard_token(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    shard_state* state = shard_state_of(stateptr);
+    cacti_msg_free(data);
+    int previous = (state->index + shard_systems - 1) % shard_systems;
+    cacti_send_message(shards[previous], shard_roots[previous], new_fanout_message(3, 0));
+    state->token = true;
+    shard_done(stateptr);
+}
+
+void shard_ack(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    shard_state_of(stateptr)->acknowledged = true;
+    shard_done(stateptr);
+}
+
+atomic_long latency_replies;
+
+void latency_request(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    atomic_fetch_add(&latency_replies, 1);
+}
+
+role_t* new_latency_role(){
+    return new_spawn_role(&latency_request, &latency_request);
+}
+
+#define TIMER_SPREAD_USEC 100000
+
+struct timespec timers_start;
+long* timer_due; // in microseconds since timers_start
+double* timer_lateness;
+atomic_long timers_fired;
+
+double seconds_since(struct timespec* start);
+
+void timer_fire(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    long index = (long) (intptr_t) data;
+    timer_lateness[index] = seconds_since(&timers_start) * 1e6 - timer_due[index];
+    if(atomic_fetch_add(&timers_fired, 1) + 1 == timer_count){
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+void job_run(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    send_message(actor_id_self(), new_godie());
+}
+
+#define BLOCKING_SLEEP_USEC 1000
+
+struct timespec blocking_start;
+atomic_int sleepers_done;
+timer_id_t blocking_timer;
+long blocking_ticks;
+double blocking_last_tick; // in milliseconds since blocking_start
+double blocking_max_gap;
+
+void sleeper_hello(void **stateptr, size_t nbytes, void* data);
+
+void sleeper_sleep(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_sleeper_role(){
+    return new_spawn_role(&sleeper_hello, &sleeper_sleep);
+}
+
+void blocking_root_hello(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    for(int i = 0; i < blocking_sleepers; i++){
+        send_message(actor_id_self(), new_spawn(new_sleeper_role()));
+    }
+    blocking_timer = send_message_every(actor_id_self(), new_fanout_message(1, 0), BLOCKING_SLEEP_USEC,
+                                        BLOCKING_SLEEP_USEC);
+}
+
+// A tick sent as the timer is cancelled may still arrive after the last one.
+void blocking_root_tick(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    (void) data;
+    if(blocking_timer < 0) return;
+    double now = seconds_since(&blocking_start) * 1e3;
+    if(now - blocking_last_tick > blocking_max_gap){
+        blocking_max_gap = now - blocking_last_tick;
+    }
+    blocking_last_tick = now;
+    blocking_ticks += 1;
+    if(atomic_load(&sleepers_done) == blocking_sleepers){
+        cancel_timer(blocking_timer);
+        blocking_timer = -1;
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+// A sleeper keeps at most half its queue of sleeps in flight, sending itself the rest as it goes.
+typedef struct{
+    long remaining; // to execute
+    long unsent;
+}sleeper;
+
+void sleeper_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    free(data);
+    sleeper* self = malloc(sizeof(sleeper));
+    self->remaining = blocking_sleeps;
+    self->unsent = blocking_sleeps;
+    *stateptr = self;
+    for(; self->unsent > 0 && blocking_sleeps - self->unsent < ACTOR_QUEUE_LIMIT / 2; self->unsent--){
+        send_message(actor_id_self(), new_fanout_message(1, 0));
+    }
+}
+
+void sleeper_sleep(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    usleep(BLOCKING_SLEEP_USEC);
+    sleeper* self = *stateptr;
+    if(self->unsent > 0){
+        self->unsent -= 1;
+        send_message(actor_id_self(), new_fanout_message(1, 0));
+    }
+    if(--self->remaining == 0){
+        free(self);
+        atomic_fetch_add(&sleepers_done, 1);
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+// Every link of the chain spawns the next one, which introduces itself, like in factorial.c.
+// The father then hands it the number of links left and dies. One link is spawned at a time.
+atomic_bool chain_done;
+actor_id_t chain_last;
+double chain_requested; // when the current link was spawned
+
+void chain_hello(void **stateptr, size_t nbytes, void* data);
+
+void chain_introduced(void **stateptr, size_t nbytes, void* data);
+
+void chain_continue(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_chain_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 3;
+    void** prompts = malloc(3 * sizeof(act_t));
+    prompts[0] = &chain_hello;
+    prompts[1] = &chain_introduced;
+    prompts[2] = &chain_continue;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+// The links left to spawn are kept in the state.
+void chain_spawn(void **stateptr, long remaining){
+    if(remaining == 0){
+        chain_last = actor_id_self();
+        atomic_store(&chain_done, true);
+        send_message(actor_id_self(), new_godie());
+        return;
+    }
+    *stateptr = (void*) (intptr_t) remaining;
+    chain_requested = now_usec();
+    send_message(actor_id_self(), new_spawn(new_chain_role()));
+}
+
+void chain_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        chain_spawn(stateptr, chain_links - 1);
+        return;
+    }
+    actor_id_t father = *((actor_id_t*) data);
+    free(data);
+    send_message(father, new_fanout_message(1, actor_id_self()));
+}
+
+void chain_introduced(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    record_latency(now_usec() - chain_requested);
+    send_message((actor_id_t) (intptr_t) data, new_fanout_message(2, (intptr_t) *stateptr - 1));
+    send_message(actor_id_self(), new_godie());
+}
+
+void chain_continue(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    chain_spawn(stateptr, (long) (intptr_t) data);
+}
+
+// Every node of the skynet tree spawns its ten children, which introduce themselves and get
+// their level and number. A leaf sends its number to its father, which sends the sum of its
+// children's to its own once it has all of them, and then dies.
+#define SKYNET_WIDTH 10
+
+typedef struct{
+    actor_id_t father; // -1 for the root
+    int level;
+    long number;
+    int introduced;
+    int reported;
+    long sum;
+    double requested; // when the children were spawned
+} skynet_node;
+
+typedef struct{
+    int level;
+    long number;
+} skynet_assignment;
+
+long skynet_sum;
+
+void skynet_hello(void **stateptr, size_t nbytes, void* data);
+
+void skynet_introduced(void **stateptr, size_t nbytes, void* data);
+
+void skynet_assigned(void **stateptr, size_t nbytes, void* data);
+
+void skynet_result(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_skynet_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 4;
+    void** prompts = malloc(4 * sizeof(act_t));
+    prompts[0] = &skynet_hello;
+    prompts[1] = &skynet_introduced;
+    prompts[2] = &skynet_assigned;
+    prompts[3] = &skynet_result;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+void skynet_start(void **stateptr, actor_id_t father, int level, long number){
+    if(level == skynet_depth){
+        send_message_inline(father, 3, &number, sizeof(long));
+        send_message(actor_id_self(), new_godie());
+        return;
+    }
+    skynet_node* node = malloc(sizeof(skynet_node));
+    node->father = father;
+    node->level = level;
+    node->number = number;
+    node->introduced = 0;
+    node->reported = 0;
+    node->sum = 0;
+    node->requested = now_usec();
+    *stateptr = node;
+    for(int i = 0; i < SKYNET_WIDTH; i++){
+        send_message(actor_id_self(), new_spawn(new_skynet_role()));
+    }
+}
+
+void skynet_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        skynet_start(stateptr, -1, 0, 0);
+        return;
+    }
+    actor_id_t father = *((actor_id_t*) data);
+    free(data);
+    *stateptr = (void*) (intptr_t) father;
+    send_message(father, new_fanout_message(1, actor_id_self()));
+}
+
+// The latency of the first child's introduction is sampled.
+void skynet_introduced(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    skynet_node* node = *stateptr;
+    if(node->introduced == 0) record_latency(now_usec() - node->requested);
+    skynet_assignment assignment = {node->level + 1, node->number * SKYNET_WIDTH + node->introduced++};
+    send_message_inline((actor_id_t) (intptr_t) data, 2, &assignment, sizeof(skynet_assignment));
+}
+
+void skynet_assigned(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    skynet_assignment* assignment = data;
+    skynet_start(stateptr, (actor_id_t) (intptr_t) *stateptr, assignment->level, assignment->number);
+}
+
+void skynet_result(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    skynet_node* node = *stateptr;
+    node->sum += *((long*) data);
+    if(++node->reported < SKYNET_WIDTH) return;
+    if(node->father < 0) skynet_sum = node->sum;
+    else send_message_inline(node->father, 3, &node->sum, sizeof(long));
+    free(node);
+    *stateptr = NULL;
+    send_message(actor_id_self(), new_godie());
+}
+
+// The consumer is the first actor, it spawns the producers. A producer sends a batch of
+// messages at a time, then sends itself a message to go on with the next one, so that
+// the batch waits for room in the consumer's queue first. A sampled message carries
+// the time it was sent, in nanoseconds, others carry 0.
+#define MPSC_BATCH 64
+
+long mpsc_received;
+
+void mpsc_hello(void **stateptr, size_t nbytes, void* data);
+
+void mpsc_produce(void **stateptr, size_t nbytes, void* data);
+
+void mpsc_consume(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_mpsc_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 3;
+    void** prompts = malloc(3 * sizeof(act_t));
+    prompts[0] = &mpsc_hello;
+    prompts[1] = &mpsc_produce;
+    prompts[2] = &mpsc_consume;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+typedef struct{
+    actor_id_t consumer;
+    long remaining;
+} mpsc_producer;
+
+void mpsc_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        for(int i = 0; i < mpsc_producers; i++){
+            send_message(actor_id_self(), new_spawn(new_mpsc_role()));
+        }
+        return;
+    }
+    mpsc_producer* producer = malloc(sizeof(mpsc_producer));
+    producer->consumer = *((actor_id_t*) data);
+    producer->remaining = mpsc_messages;
+    free(data);
+    *stateptr = producer;
+    send_message(actor_id_self(), new_fanout_message(1, 0));
+}
+
+void mpsc_produce(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    mpsc_producer* producer = *stateptr;
+    for(int i = 0; i < MPSC_BATCH && producer->remaining > 0; i++){
+        producer->remaining -= 1;
+        intptr_t sent = producer->remaining % LATENCY_SAMPLE_EVERY == 0 ? (intptr_t) (now_usec() * 1e3) : 0;
+        send_message_wait(producer->consumer, new_fanout_message(2, sent));
+    }
+    if(producer->remaining > 0){
+        send_message(actor_id_self(), new_fanout_message(1, 0));
+    }
+    else{
+        free(producer);
+        *stateptr = NULL;
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+void mpsc_consume(void **stateptr, size_t nbytes, void* data){
+    (void) stateptr;
+    (void) nbytes;
+    intptr_t sent = (intptr_t) data;
+    if(sent != 0) record_latency(now_usec() - sent / 1e3);
+    if(++mpsc_received == mpsc_producers * mpsc_messages){
+        send_message(actor_id_self(), new_godie());
+    }
+}
+
+// The columns are spawned one by one, like in matrix.c: every column spawns the next one,
+// which introduces itself and gets its column number. The rows come from main, which waits
+// for room in the first column's queue, and every column adds its cell to a row and passes
+// it on, waiting for room in the next one's. The last column passes the end of the rows on
+// and dies, like every column before it.
+#define PIPELINE_CELL_ITERATIONS 100
+
+typedef struct{
+    long row;
+    long sum;
+    double started;
+} pipeline_row;
+
+typedef struct{
+    int column;
+    actor_id_t next; // -1 for the last column
+} pipeline_column;
+
+atomic_bool pipeline_ready;
+actor_id_t pipeline_last;
+long pipeline_finished;
+long pipeline_errors;
+
+void pipeline_hello(void **stateptr, size_t nbytes, void* data);
+
+void pipeline_introduced(void **stateptr, size_t nbytes, void* data);
+
+void pipeline_numbered(void **stateptr, size_t nbytes, void* data);
+
+void pipeline_add(void **stateptr, size_t nbytes, void* data);
+
+void pipeline_end(void **stateptr, size_t nbytes, void* data);
+
+role_t* new_pipeline_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 5;
+    void** prompts = malloc(5 * sizeof(act_t));
+    prompts[0] = &pipeline_hello;
+    prompts[1] = &pipeline_introduced;
+    prompts[2] = &pipeline_numbered;
+    prompts[3] = &pipeline_add;
+    prompts[4] = &pipeline_end;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+long pipeline_cell(long row, int column){
+    volatile long accumulator = 0;
+    for(long i = 0; i < PIPELINE_CELL_ITERATIONS; i++){
+        accumulator += i;
+    }
+    return (row + column) % 10;
+}
+
+// The expected sum of a row.
+long pipeline_expected(long row){
+    long res = 0;
+    for(int column = 0; column < pipeline_columns; column++) res += (row + column) % 10;
+    return res;
+}
+
+void pipeline_number(void **stateptr, int column){
+    pipeline_column* state = malloc(sizeof(pipeline_column));
+    state->column = column;
+    state->next = -1;
+    *stateptr = state;
+    if(column + 1 < pipeline_columns){
+        send_message(actor_id_self(), new_spawn(new_pipeline_role()));
+    }
+    else{
+        pipeline_last = actor_id_self();
+        atomic_store(&pipeline_ready, true);
+    }
+}
+
+void pipeline_hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    if(data == NULL){
+        pipeline_number(stateptr, 0);
+        return;
+    }
+    actor_id_t father = *((actor_id_t*) data);
+    free(data);
+    send_message(father, new_fanout_message(1, actor_id_self()));
+}
+
+void pipeline_introduced(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    pipeline_column* state = *stateptr;
+    state->next = (actor_id_t) (intptr_t) data;
+    send_message(state->next, new_fanout_message(2, state->column + 1));
+}
+
+void pipeline_numbered(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    pipeline_number(stateptr, (int) (intptr_t) data);
+}
+
+void pipeline_add(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    pipeline_column* state = *stateptr;
+    pipeline_row* row = data;
+    row->sum += pipeline_cell(row->row, state->column);
+    if(state->next >= 0){
+        send_message_wait(state->next, new_fanout_message(3, (intptr_t) row));
+        return;
+    }
+    record_latency(now_usec() - row->started);
+    if(row->sum != pipeline_expected(row->row)) pipeline_errors += 1;
+    pipeline_finished += 1;
+    cacti_msg_free(row);
+}
+
+void pipeline_end(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    pipeline_column* state = *stateptr;
+    if(state->next >= 0) send_message_wait(state->next, new_fanout_message(4, 0));
+    free(state);
+    *stateptr = NULL;
+    send_message(actor_id_self(), new_godie());
+}
+
+long current_rss_kb(){
+    long size, pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm != NULL){
+        if(fscanf(statm, "%ld %ld", &size, &pages) != 2) pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+long peak_rss_kb(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// The CPU time used by the process since the previous call, by all its threads.
+double cpu_seconds(){
+    static double previous = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    double total = now.tv_sec + now.tv_nsec / 1e9;
+    double res = total - previous;
+    previous = total;
+    return res;
+}
+
+double seconds_since(struct timespec* start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int pinned_cpus[64];
+
+void parse_cpus(const char* list){
+    if(strcmp(list, "cores") == 0){
+        config.affinity = CACTI_AFFINITY_CORES;
+        return;
+    }
+    config.affinity = CACTI_AFFINITY_CPUS;
+    config.cpus = pinned_cpus;
+    config.ncpus = 0;
+    for(const char* cpu = list; cpu != NULL && config.ncpus < 64; cpu = strchr(cpu, ',')){
+        if(*cpu == ',') cpu++;
+        pinned_cpus[config.ncpus++] = atoi(cpu);
+    }
+}
+
+void parse_options(int argc, char** argv){
+    actor_system_default_config(&config);
+    int option;
+    while((option = getopt(argc, argv, "t:e:n:m:i:q:u:c:d:T:r:pPbgk")) != -1){
+        switch(option){
+            case 't': config.workers = atoi(optarg); break;
+            case 'e': config.elastic = true; config.max_workers = atoi(optarg); break;
+            case 'n':
+                fanout_workers = spawn_spawners = multicast_members = shard_systems = blocking_sleepers = atoi(optarg);
+                if(fanout_workers > FANOUT_IN_FLIGHT) fanout_workers = FANOUT_IN_FLIGHT;
+                mpsc_producers = pipeline_columns = atoi(optarg);
+                idle_actors = chain_links = atol(optarg);
+                skynet_depth = 1;
+                for(long leaves = SKYNET_WIDTH; leaves * SKYNET_WIDTH <= atol(optarg); leaves *= SKYNET_WIDTH){
+                    skynet_depth += 1;
+                }
+                break;
+            case 'm':
+                fanout_messages = spawn_children = pingpong_messages = bulk_messages = atol(optarg);
+                multicast_events = priority_rounds = shard_messages = latency_rounds = job_count = timer_count = atol(optarg);
+                blocking_sleeps = mpsc_messages = pipeline_rows = atol(optarg);
+                break;
+            case 'i': fanout_iterations = atol(optarg); break;
+            case 'q': config.throughput_messages = atol(optarg); break;
+            case 'u': config.throughput_usec = atol(optarg); break;
+            case 'c': parse_cpus(optarg); break;
+            case 'd': config.metrics_dump_usec = atol(optarg); break;
+            case 'T': config.trace_path = optarg; break;
+            case 'r': config.run_next_limit = atoi(optarg); break;
+            case 'p': pingpong_payload = PAYLOAD_MALLOC; break;
+            case 'P': pingpong_payload = PAYLOAD_POOL; break;
+            case 'b': bulk_batched = true; break;
+            case 'g': multicast_grouped = true; break;
+            case 'k': blocking_flagged = false; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads] [-e max threads] [-n actors] [-m messages] "
+                                "[-i iterations] [-q quantum messages] [-u quantum microseconds] "
+                                "[-c cores|cpu,...] [-d dump microseconds] [-T trace file] [-r run-next limit] "
+                                "[-p|-P] [-b] [-g] [-k] "
+                                "[fanout|idle|spawn|pingpong|bulk|multicast|priority|shards|latency|jobs|timers|blocking|"
+                                "chain|skynet|mpsc|pipeline|suite]\n", argv[0]);
+                exit(1);
+        }
+    }
+}
+
+// Ends the workload's line with the fields the whole suite reports, from the latency samples
+// recorded meanwhile, which are then dropped.
+void print_summary(long messages, double elapsed){
+    long count = atomic_load(&latency_count);
+    if(count > LATENCY_SAMPLES) count = LATENCY_SAMPLES;
+    qsort(latency_samples, count, sizeof(double), &compare_doubles);
+    printf(" messages=%ld seconds=%.3f msgs_per_sec=%.0f p50_us=%.1f p99_us=%.1f peak_rss_kb=%ld\n",
+           messages, elapsed, messages / elapsed, count > 0 ? latency_samples[count / 2] : 0,
+           count > 0 ? latency_samples[count * 99 / 100] : 0, peak_rss_kb());
+    atomic_store(&latency_count, 0);
+}
+
+void run_fanout(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_fanout_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    printf("fanout threads=%d%s workers=%d quantum=%zu/%ldus", config.workers, config.elastic ? "+" : "",
+           fanout_workers, config.throughput_messages, config.throughput_usec);
+    print_summary(2 * fanout_workers * fanout_messages, elapsed);
+}
+
+void run_idle(){
+    long rss_before = current_rss_kb();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    atomic_store(&idle_spawned, 1);
+    actor_id_t root;
+    actor_system_create_with(&root, new_idle_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    while(atomic_load(&idle_ready) < idle_actors){
+        usleep(1000);
+    }
+    double elapsed = seconds_since(&start);
+    long rss = current_rss_kb() - rss_before;
+    for(actor_id_t actor = 0; actor < idle_actors; actor++){
+        send_message(actor, new_godie());
+    }
+    actor_system_join(root);
+    printf("idle threads=%d actors=%ld seconds=%.3f rss_kb=%ld bytes_per_actor=%.0f peak_rss_kb=%ld\n",
+           config.workers, idle_actors, elapsed, rss, rss * 1024.0 / idle_actors, peak_rss_kb());
+}
+
+void run_spawn(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_spawn_role(&spawn_root_hello, &spawn_child_ping), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    long spawned = spawn_spawners * spawn_children;
+    printf("spawn threads=%d%s spawners=%d spawned=%ld seconds=%.3f spawns_per_sec=%.0f msgs_per_sec=%.0f peak_rss_kb=%ld\n",
+           config.workers, config.elastic ? "+" : "", spawn_spawners, spawned, elapsed,
+           spawned / elapsed, 3 * spawned / elapsed, peak_rss_kb());
+}
+
+void run_pingpong(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_pingpong_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    long allocated = pingpong_allocations_after - pingpong_allocations_before;
+    printf("pingpong threads=%d payload=%s allocs_per_msg=%.3f", config.workers, payload_names[pingpong_payload],
+           (double) allocated / pingpong_messages);
+    print_summary(pingpong_messages, elapsed);
+}
+
+void run_chain(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_chain_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    while(!atomic_load(&chain_done)){
+        usleep(100);
+    }
+    double elapsed = seconds_since(&start);
+    actor_system_join(chain_last);
+    // A spawn, a hello, an introduction, a handover and a death per link.
+    printf("chain threads=%d links=%ld", config.workers, chain_links);
+    print_summary(5 * chain_links, elapsed);
+}
+
+void run_skynet(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_skynet_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    long leaves = 1, actors = 1;
+    for(int i = 0; i < skynet_depth; i++){
+        leaves *= SKYNET_WIDTH;
+        actors += leaves;
+    }
+    // A spawn, a hello, an introduction, an assignment, a result and a death per actor but the root.
+    printf("skynet threads=%d depth=%d actors=%ld sum=%ld expected=%ld", config.workers, skynet_depth, actors,
+           skynet_sum, leaves * (leaves - 1) / 2);
+    print_summary(6 * (actors - 1), elapsed);
+}
+
+void run_mpsc(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_mpsc_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    printf("mpsc threads=%d producers=%d received=%ld", config.workers, mpsc_producers, mpsc_received);
+    print_summary(mpsc_producers * mpsc_messages, elapsed);
+}
+
+void run_pipeline(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_pipeline_role(), &config);
+    send_message(root, new_fanout_message(0, 0));
+    while(!atomic_load(&pipeline_ready)){
+        usleep(100);
+    }
+    for(long i = 0; i < pipeline_rows; i++){
+        pipeline_row* row = cacti_msg_alloc(sizeof(pipeline_row));
+        row->row = i;
+        row->sum = 0;
+        row->started = now_usec();
+        send_message_wait(root, new_fanout_message(3, (intptr_t) row));
+    }
+    send_message_wait(root, new_fanout_message(4, 0));
+    actor_system_join(pipeline_last);
+    double elapsed = seconds_since(&start);
+    printf("pipeline threads=%d columns=%d rows=%ld finished=%ld errors=%ld", config.workers, pipeline_columns,
+           pipeline_rows, pipeline_finished, pipeline_errors);
+    print_summary(pipeline_rows * pipeline_columns, elapsed);
+}
+
+void run_bulk(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_spawn_role(&bulk_hello, &bulk_produce), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    printf("bulk threads=%d sends=%s messages=%ld received=%ld seconds=%.3f msgs_per_sec=%.0f\n",
+           config.workers, bulk_batched ? "batched" : "single", bulk_messages, bulk_received, elapsed,
+           bulk_messages / elapsed);
+}
+
+void run_multicast(){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_spawn_role(&multicast_hello, &multicast_root), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    double elapsed = seconds_since(&start);
+    actor_group_destroy(multicast_group);
+    free(multicast_member_ids);
+    long delivered = atomic_load(&multicast_received);
+    printf("multicast threads=%d sends=%s members=%d events=%ld delivered=%ld seconds=%.3f deliveries_per_sec=%.0f\n",
+           config.workers, multicast_grouped ? "group" : "loop", multicast_members, multicast_events,
+           delivered, elapsed, delivered / elapsed);
+}
+
+void run_priority(){
+    priority_sent = malloc(priority_rounds * sizeof(struct timespec));
+    priority_latencies = malloc(priority_rounds * sizeof(double));
+    actor_id_t root;
+    actor_system_create_with(&root, new_priority_role(), &config);
+    long backlog = 0;
+    for(long round = 0; round < priority_rounds; round++){
+        for(int i = 0; i < PRIORITY_BACKLOG; i++){
+            send_message(root, new_fanout_message(0, backlog++));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &priority_sent[round]);
+        for(int i = 0; i < PRIORITY_PROBES; i++){
+            message_t probe = new_fanout_message(1, round * PRIORITY_PROBES + i);
+            if(round % 2 == 0) send_message_priority(root, probe);
+            else send_message(root, probe);
+        }
+        atomic_store(&priority_released, round + 1);
+        while(atomic_load(&priority_backlog_received) < backlog ||
+                atomic_load(&priority_probes_received) < (round + 1) * PRIORITY_PROBES){
+            usleep(100);
+        }
+    }
+    for(int i = 0; i < PRIORITY_BACKLOG; i++){
+        send_message(root, new_fanout_message(0, backlog++));
+    }
+    send_message(root, new_godie());
+    atomic_store(&priority_released, priority_rounds + 1);
+    actor_system_join(root);
+    double priority_max, plain_max;
+    double priority_p50 = median_of_rounds(0, &priority_max);
+    double plain_p50 = median_of_rounds(1, &plain_max);
+    printf("priority threads=%d rounds=%ld backlog=%d iterations=%ld priority_p50_us=%.1f priority_max_us=%.1f "
+           "plain_p50_us=%.1f plain_max_us=%.1f order_errors=%ld drained_after_godie=%s\n",
+           config.workers, priority_rounds, PRIORITY_BACKLOG, fanout_iterations, priority_p50, priority_max,
+           plain_p50, plain_max, priority_order_errors,
+           atomic_load(&priority_backlog_received) == backlog ? "yes" : "no");
+    free(priority_sent);
+    free(priority_latencies);
+    if(priority_order_errors > 0 || atomic_load(&priority_backlog_received) != backlog){
+        fprintf(stderr, "priority: the lanes did not keep their order\n");
+        exit(1);
+    }
+}
+
+// Runs the round trips on a system with the given idle policy, and prints their percentiles.
+void measure_latency(const char* policy, int spins, int yields){
+    actor_system_config_t latency_config = config;
+    latency_config.idle_spins = spins;
+    latency_config.idle_yields = yields;
+    double* latencies = malloc(latency_rounds * sizeof(double));
+    actor_system_t* system;
+    actor_id_t root;
+    cacti_system_create(&system, &root, new_latency_role(), &latency_config);
+    atomic_store(&latency_replies, 0);
+    for(long round = 0; round < latency_rounds; round++){
+        struct timespec sent;
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        cacti_send_message(system, root, new_fanout_message(1, 0));
+        while(atomic_load(&latency_replies) <= round) sched_yield();
+        latencies[round] = seconds_since(&sent) * 1e6;
+    }
+    cacti_send_message(system, root, new_godie());
+    cacti_system_join(system, root);
+    qsort(latencies, latency_rounds, sizeof(double), &compare_doubles);
+    printf("latency threads=%d policy=%s rounds=%ld p50_us=%.1f p99_us=%.1f cpu_seconds=%.3f\n",
+           config.workers, policy, latency_rounds, latencies[latency_rounds / 2],
+           latencies[latency_rounds * 99 / 100], cpu_seconds());
+    free(latencies);
+}
+
+void run_latency(){
+    cpu_seconds();
+    measure_latency("park", 0, 0);
+    measure_latency("yield", 0, IDLE_YIELDS);
+    measure_latency("spin", IDLE_SPINS, IDLE_YIELDS);
+}
+
+void run_jobs(){
+    double* durations = malloc(job_count * sizeof(double));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long i = 0; i < job_count; i++){
+        struct timespec created;
+        clock_gettime(CLOCK_MONOTONIC, &created);
+        actor_id_t root;
+        actor_system_create_with(&root, new_spawn_role(&job_run, &job_run), &config);
+        send_message(root, new_fanout_message(1, 0));
+        actor_system_join(root);
+        durations[i] = seconds_since(&created) * 1e6;
+    }
+    double elapsed = seconds_since(&start);
+    qsort(durations, job_count, sizeof(double), &compare_doubles);
+    printf("jobs threads=%d jobs=%ld seconds=%.3f jobs_per_sec=%.0f p50_us=%.1f p99_us=%.1f\n",
+           config.workers, job_count, elapsed, job_count / elapsed, durations[job_count / 2],
+           durations[job_count * 99 / 100]);
+    free(durations);
+}
+
+void run_timers(){
+    timer_due = malloc(timer_count * sizeof(long));
+    timer_lateness = malloc(timer_count * sizeof(double));
+    actor_id_t root;
+    actor_system_create_with(&root, new_spawn_role(&timer_fire, &timer_fire), &config);
+    clock_gettime(CLOCK_MONOTONIC, &timers_start);
+    for(long i = 0; i < timer_count; i++){
+        long delay = TIMER_SPREAD_USEC * i / timer_count;
+        timer_due[i] = (long) (seconds_since(&timers_start) * 1e6) + delay;
+        send_message_after(root, new_fanout_message(1, i), delay);
+    }
+    double started = seconds_since(&timers_start);
+    actor_system_join(root);
+    qsort(timer_lateness, timer_count, sizeof(double), &compare_doubles);
+    printf("timers threads=%d timers=%ld starts_per_sec=%.0f lateness_min_us=%.1f p50_us=%.1f p99_us=%.1f\n",
+           config.workers, timer_count, timer_count / started, timer_lateness[0],
+           timer_lateness[timer_count / 2], timer_lateness[timer_count * 99 / 100]);
+    free(timer_due);
+    free(timer_lateness);
+}
+
+void run_blocking(){
+    static act_t blocking_prompts[] = {&sleeper_sleep};
+    if(blocking_flagged){
+        config.blocking_prompts = blocking_prompts;
+        config.nblocking_prompts = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &blocking_start);
+    actor_id_t root;
+    actor_system_create_with(&root, new_spawn_role(&blocking_root_hello, &blocking_root_tick), &config);
+    send_message(root, new_fanout_message(0, 0));
+    actor_system_join(root);
+    printf("blocking threads=%d flagged=%s sleepers=%d sleeps=%ld seconds=%.3f ticks=%ld max_gap_ms=%.1f\n",
+           config.workers, blocking_flagged ? "yes" : "no", blocking_sleepers, blocking_sleeps,
+           seconds_since(&blocking_start), blocking_ticks, blocking_max_gap);
+}
+
+void run_shards(){
+    shards = malloc(shard_systems * sizeof(actor_system_t*));
+    shard_roots = malloc(shard_systems * sizeof(actor_id_t));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int i = 0; i < shard_systems; i++){
+        cacti_system_create(&shards[i], &shard_roots[i], new_shard_role(), &config);
+    }
+    for(int i = 0; i < shard_systems; i++){
+        cacti_send_message(shards[i], shard_roots[i], new_fanout_message(0, 0));
+    }
+    while(atomic_load(&shards_done) < shard_systems){
+        usleep(100);
+    }
+    for(int i = 0; i < shard_systems; i++){
+        cacti_send_message(shards[i], shard_roots[i], new_godie());
+    }
+    for(int i = 0; i < shard_systems; i++){
+        cacti_system_join(shards[i], shard_roots[i]);
+    }
+    double elapsed = seconds_since(&start);
+    long total = shard_systems * shard_messages;
+    printf("shards threads=%d systems=%d messages=%ld seconds=%.3f msgs_per_sec=%.0f\n",
+           config.workers, shard_systems, total, elapsed, total / elapsed);
+    free(shards);
+    free(shard_roots);
+}
+
+typedef struct{
+    const char* name;
+    void (*run)();
+} workload;
+
+workload workloads[] = {
+    {"fanout", &run_fanout}, {"idle", &run_idle}, {"spawn", &run_spawn}, {"pingpong", &run_pingpong},
+    {"bulk", &run_bulk}, {"multicast", &run_multicast}, {"priority", &run_priority}, {"shards", &run_shards},
+    {"latency", &run_latency}, {"jobs", &run_jobs}, {"timers", &run_timers}, {"blocking", &run_blocking},
+    {"chain", &run_chain}, {"skynet", &run_skynet}, {"mpsc", &run_mpsc}, {"pipeline", &run_pipeline}
+};
+
+const char* suite[] = {"pingpong", "fanout", "chain", "skynet", "mpsc", "pipeline"};
+
+workload* find_workload(const char* name){
+    for(size_t i = 0; i < sizeof(workloads) / sizeof(workload); i++){
+        if(strcmp(workloads[i].name, name) == 0) return &workloads[i];
+    }
+    return NULL;
+}
+
+// Every workload of the suite runs in a process of its own, so that it starts from scratch
+// and its peak RSS is its own. Returns 1 if any of them fails.
+int run_suite(){
+    int res = 0;
+    for(size_t i = 0; i < sizeof(suite) / sizeof(const char*); i++){
+        fflush(stdout);
+        pid_t child = fork();
+        if(child == 0){
+            find_workload(suite[i])->run();
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 1;
+        if(child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            fprintf(stderr, "Workload %s failed\n", suite[i]);
+            res = 1;
+        }
+    }
+    return res;
+}
+
+int main(int argc, char** argv){
+    parse_options(argc, argv);
+    const char* name = optind < argc ? argv[optind] : "fanout";
+    if(strcmp(name, "suite") == 0){
+        return run_suite();
+    }
+    workload* chosen = find_workload(name);
+    if(chosen == NULL){
+        fprintf(stderr, "Unknown workload: %s\n", name);
+        return 1;
+    }
+    chosen->run();
+    return 0;
+}
@@ -1,13 +1,17 @@
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
 #include "data_structures.h"
 #include "cacti.h"
 
 // This function is NOT mutex-guarded and shall only be called
 // by the director thread.
 void destroy_blocking_queue(blocking_queue* bq){
-    pthread_mutex_destroy(bq->mutex);
-    free(bq->mutex);
-    free(bq->buffer);
-    free(bq);
+    size_t segments = bq->size - bq->inline_size;
+    for(size_t i = 0; i * MAILBOX_SEGMENT_SIZE < segments; i++) free(atomic_load(&bq->segments[i]));
 }
 
 void destroy_role(role_t* role){
@@ -16,43 +20,177 @@ void destroy_role(role_t* role){
     free(role);
 }
 
+// The messages left in the lane are dropped, apart from the roles of spawn requests.
+// Every message pool buffer is allocated on its own, so it can be freed directly.
+void destroy_priority_lane(priority_lane* pl){
+    priority_message* pending[2] = {atomic_load(&pl->pushed), pl->taken};
+    for(int i = 0; i < 2; i++){
+        while(pending[i] != NULL){
+            priority_message* next = pending[i]->next;
+            if(pending[i]->message.message_type == MSG_SPAWN) destroy_role(pending[i]->message.data);
+            free((message_buffer*) pending[i] - 1);
+            pending[i] = next;
+        }
+    }
+}
+
+// Frees the deferred sends together with the record, their messages are dropped.
+void destroy_stall(stall* st){
+    if(st == NULL) return;
+    deferred_send* next;
+    while(st->first != NULL){
+        next = st->first->next;
+        atomic_fetch_sub(&st->first->receiver_info->blocked_senders, 1);
+        free(st->first);
+        st->first = next;
+    }
+    free(st);
+}
+
+// The record itself is freed together with its slab.
 void destroy_actor_info(actor_info* ai){
-    pthread_mutex_destroy(ai->mutex);
-    destroy_blocking_queue(ai->messages);
-    free(ai->mutex);
+    destroy_stall(ai->stall);
+    ai->stall = NULL;
+    destroy_priority_lane(&ai->priority);
+    destroy_blocking_queue(&ai->messages);
     destroy_role(ai->role);
-    free(ai);
 }
 
-void destroy_actors(actors_vector* actors){
-    for(int i = 0; i < actors->occupied; i++) destroy_actor_info(actors->actors[i]);
-    pthread_mutex_destroy(actors->mutex);
-    free(actors->mutex);
-    free(actors->actors);
+void destroy_actors(actors_directory* actors){
+    for(int i = 0; i < DIRECTORY_SEGMENTS; i++){
+        directory_entry* segment = atomic_load(&actors->segments[i]);
+        if(segment == NULL) continue;
+        for(actor_id_t j = 0; j < DIRECTORY_SEGMENT_SIZE; j++){
+            actor_info* ai = atomic_load(&segment[j].actor);
+            if(ai != NULL) destroy_actor_info(ai);
+        }
+        free(segment);
+    }
     free(actors);
 }
 
 void destroy_message_queue(message_queue* message_q){
     pthread_mutex_destroy(message_q->mutex);
-    pthread_cond_destroy(message_q->actor_cond);
     free(message_q->messages);
     free(message_q->mutex);
-    free(message_q->actor_cond);
     free(message_q);
 }
 
+void destroy_work_deque(work_deque* wd){
+    work_deque_array* array = atomic_load(&wd->array);
+    work_deque_array* previous;
+    while(array != NULL){
+        previous = array->previous;
+        free(array->buffer);
+        free(array);
+        array = previous;
+    }
+    free(wd);
+}
+
+void destroy_actor_slab(actor_slab* slab){
+    slab_chunk* next;
+    while(slab->chunks != NULL){
+        next = slab->chunks->next;
+        if(slab->chunks->mapped) munmap(slab->chunks, sizeof(slab_chunk));
+        else free(slab->chunks);
+        slab->chunks = next;
+    }
+    free(slab);
+}
+
+void destroy_message_buffers(message_buffer* buffer){
+    message_buffer* next;
+    while(buffer != NULL){
+        next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+}
+
+void destroy_message_pool(message_pool* pool){
+    for(int i = 0; i < MESSAGE_POOL_CLASSES; i++) destroy_message_buffers(pool->free[i]);
+    destroy_message_buffers(atomic_load(&pool->remote));
+    free(pool);
+}
+
 void destroy_mutex(pthread_mutex_t* mutex){
     pthread_mutex_destroy(mutex);
 }
 
+#if CACTI_TRACE
+trace_ring* new_trace_ring(int track){
+    trace_ring* res = aligned_alloc(_Alignof(trace_ring), sizeof(trace_ring));
+    atomic_init(&res->claimed, 0);
+    atomic_init(&res->head, 0);
+    res->flushed = 0;
+    res->track = track;
+    res->next = NULL;
+    res->next_free = NULL;
+    return res;
+}
+
+void destroy_trace_rings(trace_ring* ring){
+    while(ring != NULL){
+        trace_ring* next = ring->next;
+        free(ring);
+        ring = next;
+    }
+}
+#endif
+
 void destroy_system(global_data_t* global){
     destroy_actors(global->actors);
     destroy_message_queue(global->message_q);
+    if(global->node_queues != NULL){
+        for(int i = 0; i < global->nodes; i++) destroy_message_queue(global->node_queues[i]);
+        free(global->node_queues);
+    }
+    free(global->worker_cpus);
+    free((void*) global->config.blocking_prompts);
+    free(global->worker_nodes);
+    for(int i = 0; i < global->pool_capacity; i++) destroy_work_deque(global->deques[i]);
+    free(global->deques);
+    for(int i = 0; i <= global->pool_capacity; i++) destroy_actor_slab(global->slabs[i]);
+    free(global->slabs);
+    for(int i = 0; i < global->pool_capacity; i++) destroy_message_pool(global->message_pools[i]);
+    free(global->message_pools);
+    free(global->stalled);
+    free(global->run_next);
+    destroy_mutex(global->backpressure_mutex);
+    free(global->backpressure_mutex);
+    pthread_cond_destroy(global->space_cond);
+    free(global->space_cond);
+    destroy_timer_wheel(global->timers);
+    destroy_reactor(global->reactor);
+    destroy_message_queue(global->blocking_q);
+    pthread_cond_destroy(global->blocking_cond);
+    free(global->blocking_cond);
+#if CACTI_METRICS
+    free(global->metrics);
+    while(global->blocking_metrics != NULL){
+        thread_metrics* next = global->blocking_metrics->next;
+        free(global->blocking_metrics);
+        global->blocking_metrics = next;
+    }
+#endif
+#if CACTI_TRACE
+    for(int i = 0; i < global->pool_capacity; i++) free(atomic_load(&global->traces[i]));
+    free(global->traces);
+    destroy_trace_rings(global->blocking_traces);
+    free(global->outside_trace);
+    destroy_mutex(global->trace_mutex);
+    free(global->trace_mutex);
+#endif
+    free(global->thread_slots);
     destroy_mutex(global->mutex);
+    free(global->mutex);
     pthread_cond_destroy(global->started_cond);
+    free(global->started_cond);
     pthread_cond_destroy(global->thread_join_cond);
-    pthread_cond_destroy(global->sigint_cond);
-    free(global->thread_descriptors);
+    free(global->thread_join_cond);
+    pthread_cond_destroy(global->finish_cond);
+    free(global->finish_cond);
     free(global->thread_to_actor);
 }
 
@@ -70,103 +208,646 @@ pthread_cond_t* new_cond(){
     return result;
 }
 
-blocking_queue* new_blocking_queue(size_t size){
-    blocking_queue* res = malloc(sizeof(blocking_queue));
-    res->mutex = new_mutex();
-    res->size = size;
-    res->buffer = malloc(size * sizeof(message_t));
-    res->start = 0;
-    res->end = 0;
-    res->full = false;
-    return res;
+// A condition whose timed waits take CLOCK_MONOTONIC deadlines, which changes of the wall
+// clock do not move.
+pthread_cond_t* new_monotonic_cond(){
+    pthread_cond_t* result = malloc(sizeof(pthread_cond_t));
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(result, &attributes);
+    pthread_condattr_destroy(&attributes);
+    return result;
 }
 
-actor_info* new_actor_info(void *const role, actor_id_t actor_id){
-    actor_info* res = malloc(sizeof(actor_info));
-    res->actor_id = actor_id;
-    res->mutex = new_mutex();
+// The size may not exceed ACTOR_QUEUE_LIMIT.
+void init_blocking_queue(blocking_queue* bq, size_t size){
+    size_t inline_size = size < MAILBOX_INLINE_SIZE ? size : MAILBOX_INLINE_SIZE;
+    bq->size = size;
+    bq->inline_size = inline_size;
+    for(size_t i = 0; i < inline_size; i++) atomic_init(&bq->inline_slots[i].sequence, i);
+    for(size_t i = 0; i < MAILBOX_SEGMENTS; i++) atomic_init(&bq->segments[i], NULL);
+    atomic_init(&bq->start, 0);
+    atomic_init(&bq->end, 0);
+    atomic_init(&bq->shrink_position, 0);
+    atomic_init(&bq->allocated_segments, 0);
+#if CACTI_METRICS
+    atomic_init(&bq->high_water, 0);
+#endif
+}
+
+actor_info* new_actor_info(actor_slab* slab, void *const role, actor_id_t actor_id){
+    actor_info* res = actor_slab_alloc(slab);
+    // Senders looking for the record's previous actor will see the new ID from now on,
+    // the ones which might have seen the old one have to finish before the record changes.
+    atomic_store(&res->actor_id, actor_id);
+    while(atomic_load(&res->senders) > 0) sched_yield();
     res->stateptr = NULL;
-    res->dead = false;
-    res->waiting = false;
+    res->stall = NULL;
+    atomic_store(&res->dead, false);
+    atomic_init(&res->waiting, false);
     res->role = role;
-    res->messages = new_blocking_queue(ACTOR_QUEUE_LIMIT);
+    res->next_free = NULL;
+#if CACTI_METRICS
+    atomic_store(&res->executed, 0);
+#endif
+    atomic_store(&res->priority.pushed, NULL);
+    res->priority.taken = NULL;
+    res->home = slab->node;
+    init_blocking_queue(&res->messages, ACTOR_QUEUE_LIMIT);
     return res;
 }
 
-actors_vector* new_actors_vector(){
-    actors_vector* res = malloc(sizeof(actors_vector));
-    res->mutex = new_mutex();
-    res->total = 1;
-    res->occupied = 0;
-    res->actors = malloc(sizeof(actor_info*));
+actor_slab* new_actor_slab(){
+    actor_slab* res = malloc(sizeof(actor_slab));
+    res->node = -1;
+    res->chunks = NULL;
+    res->carved = ACTOR_SLAB_CHUNK;
+    res->free = NULL;
+    return res;
+}
+
+// The memory policy mbind sets, as in linux/mempolicy.h.
+#define MPOL_PREFERRED 1
+
+// A chunk of a slab with a node is mapped directly and set to prefer that node, so that
+// the records of the actors spawned there, with their inline mailbox slots, are local to it.
+// The policy is set with the raw system call, as libnuma is not available everywhere.
+slab_chunk* new_slab_chunk(int node){
+#ifdef SYS_mbind
+    if(node >= 0 && node < AFFINITY_MAX_NODES){
+        void* memory = mmap(NULL, sizeof(slab_chunk), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory != MAP_FAILED){
+            unsigned long mask = 1UL << node;
+            syscall(SYS_mbind, memory, sizeof(slab_chunk), MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+            slab_chunk* res = memory;
+            res->mapped = true;
+            return res;
+        }
+    }
+#endif
+    slab_chunk* res = aligned_alloc(_Alignof(slab_chunk), sizeof(slab_chunk));
+    res->mapped = false;
+    return res;
+}
+
+actor_info* actor_slab_alloc(actor_slab* slab){
+    actor_info* res = slab->free;
+    if(res != NULL){
+        slab->free = res->next_free;
+        return res;
+    }
+    if(slab->carved == ACTOR_SLAB_CHUNK){
+        slab_chunk* chunk = new_slab_chunk(slab->node);
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->carved = 0;
+    }
+    res = &slab->chunks->actors[slab->carved++];
+    // The counters are never reset later, as stale senders may still be changing them.
+    atomic_init(&res->senders, 0);
+    atomic_init(&res->blocked_senders, 0);
+    return res;
+}
+
+void actor_slab_free(actor_slab* slab, actor_info* ai){
+    ai->next_free = slab->free;
+    slab->free = ai;
+}
+
+message_pool* new_message_pool(){
+    message_pool* res = malloc(sizeof(message_pool));
+    for(int i = 0; i < MESSAGE_POOL_CLASSES; i++) res->free[i] = NULL;
+    atomic_init(&res->remote, NULL);
+    return res;
+}
+
+int message_size_class(size_t nbytes){
+    int res = 0;
+    while(res < MESSAGE_POOL_CLASSES && ((size_t) MESSAGE_POOL_MIN_SIZE << res) < nbytes) res++;
+    return res;
+}
+
+// Moves the buffers returned by other threads to the owner's free lists.
+void message_pool_collect(message_pool* pool){
+    message_buffer* buffer = atomic_exchange_explicit(&pool->remote, NULL, memory_order_acquire);
+    message_buffer* next;
+    while(buffer != NULL){
+        next = buffer->next;
+        buffer->next = pool->free[buffer->size_class];
+        pool->free[buffer->size_class] = buffer;
+        buffer = next;
+    }
+}
+
+void* message_pool_alloc(global_data_t* global_data, int owner, size_t nbytes){
+    int size_class = message_size_class(nbytes);
+    message_buffer* res;
+    if(owner < 0 || size_class == MESSAGE_POOL_CLASSES){
+        res = malloc(sizeof(message_buffer) + nbytes);
+        res->pool = NULL;
+        res->size_class = size_class;
+        return res + 1;
+    }
+    message_pool* pool = global_data->message_pools[owner];
+    if(pool->free[size_class] == NULL) message_pool_collect(pool);
+    res = pool->free[size_class];
+    if(res != NULL){
+        pool->free[size_class] = res->next;
+    }
+    else{
+        res = malloc(sizeof(message_buffer) + ((size_t) MESSAGE_POOL_MIN_SIZE << size_class));
+        res->size_class = size_class;
+    }
+    res->pool = pool;
+    return res + 1;
+}
+
+void message_pool_free(global_data_t* global_data, int caller, void* buffer){
+    if(buffer == NULL) return;
+    message_buffer* header = (message_buffer*) buffer - 1;
+    message_pool* pool = header->pool;
+    if(pool == NULL){
+        free(header);
+        return;
+    }
+    if(caller >= 0 && global_data->message_pools[caller] == pool){
+        header->next = pool->free[header->size_class];
+        pool->free[header->size_class] = header;
+        return;
+    }
+    message_buffer* head = atomic_load_explicit(&pool->remote, memory_order_relaxed);
+    do{
+        header->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&pool->remote, &head, header,
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+actors_directory* new_actors_directory(){
+    actors_directory* res = malloc(sizeof(actors_directory));
+    for(int i = 0; i < DIRECTORY_SEGMENTS; i++) atomic_init(&res->segments[i], NULL);
+    atomic_init(&res->occupied, 0);
+    atomic_init(&res->released, 0);
     return res;
 }
 
 message_queue* new_message_queue(){
     message_queue* res = malloc(sizeof(message_queue));
-    res->actor_cond = new_cond();
     res->mutex = new_mutex();
     res->messages = malloc(sizeof(actor_id_t));
     res->size = 1;
-    res->occupied = 0;
+    atomic_init(&res->occupied, 0);
     res->start = 0;
     res->full = false;
     return res;
 }
 
-void initialize_global_data(global_data_t* global_data){
-    global_data->num_of_actors = 1; // the director
-    global_data->alive_actors = 1;
-    global_data->actors = new_actors_vector();
+work_deque_array* new_work_deque_array(long size){
+    work_deque_array* res = malloc(sizeof(work_deque_array));
+    res->size = size;
+    res->buffer = malloc(size * sizeof(actor_id_t));
+    res->previous = NULL;
+    return res;
+}
+
+work_deque* new_work_deque(){
+    work_deque* res = malloc(sizeof(work_deque));
+    atomic_init(&res->top, 0);
+    atomic_init(&res->bottom, 0);
+    atomic_init(&res->array, new_work_deque_array(64));
+    return res;
+}
+
+#if CACTI_METRICS
+void init_thread_metrics(thread_metrics* tm){
+    memset(tm, 0, sizeof(thread_metrics));
+    tm->next = NULL;
+    tm->next_free = NULL;
+}
+
+thread_metrics* new_thread_metrics(){
+    thread_metrics* res = aligned_alloc(_Alignof(thread_metrics), sizeof(thread_metrics));
+    init_thread_metrics(res);
+    return res;
+}
+#endif
+
+void initialize_global_data(global_data_t* global_data, const actor_system_config_t* config){
+    atomic_init(&global_data->alive_actors, 1);
+    global_data->actors = new_actors_directory();
     global_data->message_q = new_message_queue();
+    global_data->worker_cpus = NULL;
+    global_data->nodes = 1;
+    global_data->node_queues = NULL;
+    global_data->config = *config;
+    global_data->config.blocking_prompts = NULL;
+    if(config->nblocking_prompts > 0){
+        void* prompts = malloc(config->nblocking_prompts * sizeof(act_t));
+        memcpy(prompts, config->blocking_prompts, config->nblocking_prompts * sizeof(act_t));
+        global_data->config.blocking_prompts = prompts;
+    }
+    atomic_init(&global_data->throughput_messages, config->throughput_messages);
+    atomic_init(&global_data->throughput_usec, config->throughput_usec);
+    global_data->pool_capacity = config->max_workers;
+    global_data->deques = malloc(global_data->pool_capacity * sizeof(work_deque*));
+    global_data->slabs = malloc((global_data->pool_capacity + 1) * sizeof(actor_slab*));
+    for(int i = 0; i <= global_data->pool_capacity; i++) global_data->slabs[i] = new_actor_slab();
+    global_data->message_pools = malloc(global_data->pool_capacity * sizeof(message_pool*));
+    for(int i = 0; i < global_data->pool_capacity; i++) global_data->message_pools[i] = new_message_pool();
+    global_data->stalled = malloc(global_data->pool_capacity * sizeof(actor_info*));
+    for(int i = 0; i < global_data->pool_capacity; i++) global_data->stalled[i] = NULL;
+    global_data->run_next = aligned_alloc(_Alignof(run_next_slot), global_data->pool_capacity * sizeof(run_next_slot));
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        global_data->run_next[i].actor = WORK_DEQUE_EMPTY;
+        global_data->run_next[i].streak = 0;
+    }
+    global_data->worker_nodes = malloc(global_data->pool_capacity * sizeof(int));
+    for(int i = 0; i < global_data->pool_capacity; i++) global_data->worker_nodes[i] = -1;
+    global_data->backpressure_mutex = new_mutex();
+    global_data->space_cond = new_cond();
+    global_data->timers = new_timer_wheel();
+    global_data->reactor = new_reactor();
+    global_data->blocking_q = new_message_queue();
+    global_data->blocking_cond = new_cond();
+    global_data->blocking_threads = 0;
+    global_data->idle_blocking = 0;
+#if CACTI_METRICS
+    global_data->metrics = aligned_alloc(_Alignof(thread_metrics), global_data->pool_capacity * sizeof(thread_metrics));
+    for(int i = 0; i < global_data->pool_capacity; i++) init_thread_metrics(&global_data->metrics[i]);
+    global_data->blocking_metrics = NULL;
+    global_data->free_metrics = NULL;
+#endif
+#if CACTI_TRACE
+    global_data->traces = malloc(global_data->pool_capacity * sizeof(_Atomic(trace_ring*)));
+    for(int i = 0; i < global_data->pool_capacity; i++) atomic_init(&global_data->traces[i], NULL);
+    global_data->blocking_traces = NULL;
+    global_data->free_traces = NULL;
+    global_data->blocking_tracks = 0;
+    global_data->outside_trace = NULL;
+    global_data->trace_mutex = new_mutex();
+    global_data->trace_start_tsc = trace_clock();
+    clock_gettime(CLOCK_MONOTONIC, &global_data->trace_start);
+#endif
+    global_data->thread_slots = malloc(global_data->pool_capacity * sizeof(atomic_bool));
+    for(int i = 0; i < global_data->pool_capacity; i++){
+        global_data->deques[i] = new_work_deque();
+        atomic_init(&global_data->thread_slots[i], false);
+    }
+    atomic_init(&global_data->idle_threads, 0);
+    atomic_init(&global_data->parked_threads, 0);
+    atomic_init(&global_data->idle_futex, 0);
+    atomic_init(&global_data->active_threads, 0);
+    atomic_flag_clear(&global_data->growing);
     global_data->mutex = new_mutex();
     global_data->started = false;
-    global_data->finished = false;
-    global_data->thread_to_actor = malloc(POOL_SIZE * sizeof(actor_id_t));
+    atomic_init(&global_data->finished, false);
+    global_data->stopping = false;
+    atomic_init(&global_data->actor_joiners, 0);
+    global_data->next_interruptible = NULL;
+    global_data->thread_to_actor = malloc(global_data->pool_capacity * sizeof(actor_id_t));
     global_data->thread_join_cond = new_cond();
     global_data->started_cond = new_cond();
-    global_data->sigint_cond = new_cond();
-    global_data->finished_threads = 0;
+    global_data->finish_cond = new_cond();
+    global_data->running_threads = 0;
+}
+
+// Returns the slot for the given position, or NULL if its segment is not allocated.
+mailbox_slot* bl_queue_slot(blocking_queue* bq, size_t position){
+    size_t offset = position % bq->size;
+    if(offset < bq->inline_size) return &bq->inline_slots[offset];
+    offset -= bq->inline_size;
+    mailbox_slot* segment = atomic_load_explicit(&bq->segments[offset / MAILBOX_SEGMENT_SIZE],
+                                                 memory_order_acquire);
+    if(segment == NULL) return NULL;
+    return &segment[offset % MAILBOX_SEGMENT_SIZE];
 }
 
-message_t bl_queue_pop(blocking_queue* bq){
-    pthread_mutex_lock(bq->mutex);
-    message_t res = bq->buffer[bq->start];
-    bq->full = false;
-    bq->start = (bq->start + 1) % (bq->size);
-    pthread_mutex_unlock(bq->mutex);
+// Allocates the segment for a position reserved by the calling push. Pushes reserving other
+// positions of the same segment may race to do it, only one of the segments is kept.
+// A slot of the new segment whose position in the current cycle was already popped before
+// the queue was last drained is free only for the push one cycle later.
+mailbox_slot* allocate_segment(blocking_queue* bq, size_t position){
+    size_t offset = position % bq->size - bq->inline_size;
+    size_t index = offset / MAILBOX_SEGMENT_SIZE;
+    size_t count = bq->size - bq->inline_size - index * MAILBOX_SEGMENT_SIZE;
+    if(count > MAILBOX_SEGMENT_SIZE) count = MAILBOX_SEGMENT_SIZE;
+    size_t first = position - offset % MAILBOX_SEGMENT_SIZE;
+    size_t drained = atomic_load_explicit(&bq->shrink_position, memory_order_relaxed);
+    mailbox_slot* segment = malloc(count * sizeof(mailbox_slot));
+    for(size_t i = 0; i < count; i++){
+        atomic_init(&segment[i].sequence, first + i < drained ? first + i + bq->size : first + i);
+    }
+    mailbox_slot* expected = NULL;
+    if(atomic_compare_exchange_strong_explicit(&bq->segments[index], &expected, segment,
+            memory_order_acq_rel, memory_order_acquire)){
+        atomic_fetch_add_explicit(&bq->allocated_segments, 1, memory_order_relaxed);
+    }
+    else{
+        free(segment);
+        segment = expected;
+    }
+    return &segment[offset % MAILBOX_SEGMENT_SIZE];
+}
+
+// A slot at position p holds the sequence number p when it is free for the push at p,
+// and p+1 once the message pushed at p is ready to be popped. Popping it sets the number
+// to p+size, freeing the slot for the push one cycle later.
+message_t bl_queue_pop(blocking_queue* bq, void* payload, payload_kind* kind){
+    size_t position = atomic_load_explicit(&bq->start, memory_order_relaxed);
+    mailbox_slot* slot = bl_queue_slot(bq, position);
+    message_t res;
+    res.message_type = slot->message_type;
+    res.nbytes = slot->nbytes;
+    *kind = slot->kind;
+    if(slot->kind == MAILBOX_INLINE){
+        memcpy(payload, slot->payload, slot->nbytes);
+        res.data = payload;
+    }
+    else{
+        res.data = slot->data;
+    }
+    atomic_store_explicit(&slot->sequence, position + bq->size, memory_order_release);
+    atomic_store_explicit(&bq->start, position + 1, memory_order_release);
     return res;
 }
 
-bool bl_queue_push(blocking_queue* bq, message_t new_el){
-    pthread_mutex_lock(bq->mutex);
-    if(bq->full){
-        pthread_mutex_unlock(bq->mutex);
-        return false;
+#if CACTI_METRICS
+void raise_high_water(blocking_queue* bq, size_t depth){
+    size_t high = atomic_load_explicit(&bq->high_water, memory_order_relaxed);
+    while(depth > high && !atomic_compare_exchange_weak_explicit(&bq->high_water, &high, depth,
+            memory_order_relaxed, memory_order_relaxed));
+}
+#endif
+
+// A push reserves its positions by advancing the end, as far as the queue is not full.
+// The slot at a reserved position has already been freed by the pop one cycle earlier,
+// as that pop advanced the start before the reservation.
+size_t bl_queue_push_many(blocking_queue* bq, const message_t* new_els, size_t count, payload_kind kind){
+    size_t position = atomic_load_explicit(&bq->end, memory_order_relaxed);
+    size_t reserved;
+    while(true){
+        if(position & MAILBOX_SHRINKING){
+            sched_yield();
+            position = atomic_load_explicit(&bq->end, memory_order_relaxed);
+            continue;
+        }
+        size_t start = atomic_load_explicit(&bq->start, memory_order_acquire);
+        long occupied = (long) (position - start);
+        if(occupied < 0){
+            // The end was read before the start caught up with it.
+            position = atomic_load_explicit(&bq->end, memory_order_relaxed);
+            continue;
+        }
+        if((size_t) occupied >= bq->size){
+            return 0;
+        }
+        reserved = bq->size - (size_t) occupied;
+        if(reserved > count) reserved = count;
+        if(atomic_compare_exchange_weak_explicit(&bq->end, &position, position + reserved,
+                memory_order_acquire, memory_order_relaxed)){
+#if CACTI_METRICS
+            raise_high_water(bq, (size_t) occupied + reserved);
+#endif
+            break;
+        }
     }
-    bq->buffer[bq->end] = new_el;
-    bq->end = (bq->end + 1) % (bq->size);
-    if(bq->start == bq->end) bq->full = true;
-    pthread_mutex_unlock(bq->mutex);
-    return true;
+#if CACTI_METRICS
+    uint64_t sent = metrics_clock();
+#endif
+    for(size_t i = 0; i < reserved; i++, position++){
+        mailbox_slot* slot = bl_queue_slot(bq, position);
+        if(slot == NULL) slot = allocate_segment(bq, position);
+        slot->message_type = new_els[i].message_type;
+        slot->nbytes = new_els[i].nbytes;
+        slot->kind = kind;
+#if CACTI_METRICS
+        slot->sent = sent;
+#endif
+        if(kind != MAILBOX_INLINE) slot->data = new_els[i].data;
+        else if(new_els[i].nbytes > 0) memcpy(slot->payload, new_els[i].data, new_els[i].nbytes);
+        atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+    }
+    return reserved;
+}
+
+bool bl_queue_push(blocking_queue* bq, message_t new_el, payload_kind kind){
+    return bl_queue_push_many(bq, &new_el, 1, kind) == 1;
+}
+
+void priority_lane_push(priority_lane* pl, priority_message* new_el){
+    priority_message* head = atomic_load_explicit(&pl->pushed, memory_order_relaxed);
+    do{
+        new_el->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&pl->pushed, &head, new_el,
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+// The stack is only exchanged when there is something on it, as the lane is checked
+// before every message the actor executes.
+priority_message* priority_lane_peek(priority_lane* pl){
+    if(pl->taken == NULL){
+        if(atomic_load_explicit(&pl->pushed, memory_order_relaxed) == NULL) return NULL;
+        priority_message* pushed = atomic_exchange_explicit(&pl->pushed, NULL, memory_order_acquire);
+        while(pushed != NULL){
+            priority_message* next = pushed->next;
+            pushed->next = pl->taken;
+            pl->taken = pushed;
+            pushed = next;
+        }
+    }
+    return pl->taken;
+}
+
+priority_message* priority_lane_pop(priority_lane* pl){
+    priority_message* res = priority_lane_peek(pl);
+    if(res != NULL) pl->taken = res->next;
+    return res;
+}
+
+bool priority_lane_empty(priority_lane* pl){
+    return pl->taken == NULL && priority_lane_unpushed(pl);
+}
+
+// Whether nothing has been pushed since the last pop. Unlike priority_lane_empty, it may be
+// called by a thread which is not executing the actor.
+bool priority_lane_unpushed(priority_lane* pl){
+    return atomic_load_explicit(&pl->pushed, memory_order_acquire) == NULL;
 }
 
 bool bl_queue_empty(blocking_queue* bq){
-    pthread_mutex_lock(bq->mutex);
-    bool res = (bq->end == bq->start) && (! bq->full);
-    pthread_mutex_unlock(bq->mutex);
+    size_t position = atomic_load_explicit(&bq->start, memory_order_relaxed);
+    mailbox_slot* slot = bl_queue_slot(bq, position);
+    return slot == NULL || atomic_load_explicit(&slot->sequence, memory_order_acquire) != position + 1;
+}
+
+// A push reserves its position before the slot is written, so a thread which is not executing
+// the actor can tell there are messages coming without touching the slots, whose segments
+// may be freed meanwhile.
+bool bl_queue_unpushed(blocking_queue* bq){
+    return atomic_load_explicit(&bq->end, memory_order_acquire) == atomic_load_explicit(&bq->start, memory_order_acquire);
+}
+
+message_type_t bl_queue_front_type(blocking_queue* bq){
+    return bl_queue_slot(bq, atomic_load_explicit(&bq->start, memory_order_relaxed))->message_type;
+}
+
+#if CACTI_METRICS
+uint64_t bl_queue_front_sent(blocking_queue* bq){
+    return bl_queue_slot(bq, atomic_load_explicit(&bq->start, memory_order_relaxed))->sent;
+}
+#endif
+
+size_t bl_queue_depth(blocking_queue* bq){
+    size_t start = atomic_load_explicit(&bq->start, memory_order_relaxed);
+    size_t end = atomic_load_explicit(&bq->end, memory_order_relaxed) & ~MAILBOX_SHRINKING;
+    return end > start ? end - start : 0;
+}
+
+// No push holds a reserved position while the end equals the start,
+// so marking the end keeps all of them away from the segments.
+// The queue also moves on to the start of the next cycle, if it is past its inline slots,
+// so that an actor which gets one message at a time never needs a segment.
+void bl_queue_shrink(blocking_queue* bq){
+    size_t position = atomic_load_explicit(&bq->start, memory_order_relaxed);
+    bool rebase = position % bq->size >= bq->inline_size;
+    if(!rebase && atomic_load_explicit(&bq->allocated_segments, memory_order_relaxed) == 0) return;
+    size_t expected = position;
+    if(!atomic_compare_exchange_strong_explicit(&bq->end, &expected, position | MAILBOX_SHRINKING,
+            memory_order_acquire, memory_order_relaxed)){
+        return;
+    }
+    size_t segments = bq->size - bq->inline_size;
+    for(size_t i = 0; i * MAILBOX_SEGMENT_SIZE < segments; i++){
+        free(atomic_load_explicit(&bq->segments[i], memory_order_relaxed));
+        atomic_store_explicit(&bq->segments[i], NULL, memory_order_relaxed);
+    }
+    atomic_store_explicit(&bq->allocated_segments, 0, memory_order_relaxed);
+    if(rebase){
+        position += bq->size - position % bq->size;
+        for(size_t i = 0; i < bq->inline_size; i++){
+            atomic_store_explicit(&bq->inline_slots[i].sequence, position + i, memory_order_relaxed);
+        }
+        atomic_store_explicit(&bq->start, position, memory_order_relaxed);
+    }
+    atomic_store_explicit(&bq->shrink_position, position, memory_order_relaxed);
+    atomic_store_explicit(&bq->end, position, memory_order_release);
+}
+
+// Returns the entry of the slot, or NULL if its segment has not been allocated yet.
+directory_entry* directory_entry_of(actors_directory* ad, actor_id_t slot){
+    directory_entry* segment = atomic_load_explicit(&ad->segments[slot >> DIRECTORY_SEGMENT_BITS],
+                                                    memory_order_acquire);
+    if(segment == NULL) return NULL;
+    return &segment[slot & (DIRECTORY_SEGMENT_SIZE - 1)];
+}
+
+// Threads appending to a new segment race to allocate it, and the losers free their copies.
+void allocate_directory_segment(actors_directory* ad, actor_id_t slot){
+    _Atomic(directory_entry*)* place = &ad->segments[slot >> DIRECTORY_SEGMENT_BITS];
+    if(atomic_load_explicit(place, memory_order_acquire) != NULL) return;
+    directory_entry* segment = malloc(DIRECTORY_SEGMENT_SIZE * sizeof(directory_entry));
+    for(actor_id_t i = 0; i < DIRECTORY_SEGMENT_SIZE; i++){
+        atomic_init(&segment[i].actor, NULL);
+        atomic_init(&segment[i].released_id, 0);
+        atomic_init(&segment[i].next_released, 0);
+    }
+    directory_entry* expected = NULL;
+    if(!atomic_compare_exchange_strong_explicit(place, &expected, segment,
+                                                memory_order_acq_rel, memory_order_acquire)){
+        free(segment);
+    }
+}
+
+actor_id_t pop_released(actors_directory* ad){
+    uint64_t head = atomic_load_explicit(&ad->released, memory_order_acquire);
+    while(true){
+        uint32_t top = (uint32_t) head;
+        if(top == 0) return -1;
+        directory_entry* entry = directory_entry_of(ad, top - 1);
+        uint64_t next = (head & ~(uint64_t) UINT32_MAX) + ((uint64_t) 1 << 32)
+                        + atomic_load_explicit(&entry->next_released, memory_order_relaxed);
+        if(atomic_compare_exchange_weak_explicit(&ad->released, &head, next,
+                                                 memory_order_acquire, memory_order_acquire)){
+            return atomic_load_explicit(&entry->released_id, memory_order_relaxed);
+        }
+    }
+}
+
+actor_id_t actors_directory_reserve(actors_directory* ad){
+    actor_id_t res = pop_released(ad);
+    if(res >= 0) return res;
+    res = atomic_load_explicit(&ad->occupied, memory_order_relaxed);
+    do{
+        if(res >= CAST_LIMIT) return -1;
+    } while(!atomic_compare_exchange_weak_explicit(&ad->occupied, &res, res + 1,
+                                                   memory_order_relaxed, memory_order_relaxed));
+    allocate_directory_segment(ad, res);
+    return res;
+}
+
+void actors_directory_set(actors_directory* ad, actor_info* ai){
+    directory_entry* entry = directory_entry_of(ad, actor_slot(ai->actor_id));
+    atomic_store_explicit(&entry->actor, ai, memory_order_release);
+}
+
+actor_info* actors_directory_get(actors_directory* ad, actor_id_t actor_id){
+    actor_id_t slot = actor_slot(actor_id);
+    if(slot >= CAST_LIMIT) return NULL;
+    directory_entry* entry = directory_entry_of(ad, slot);
+    if(entry == NULL) return NULL;
+    return atomic_load_explicit(&entry->actor, memory_order_acquire);
+}
+
+actor_id_t actors_directory_size(actors_directory* ad){
+    return atomic_load_explicit(&ad->occupied, memory_order_relaxed);
+}
+
+void actors_directory_release(actors_directory* ad, actor_id_t actor_id){
+    actor_id_t slot = actor_slot(actor_id);
+    directory_entry* entry = directory_entry_of(ad, slot);
+    atomic_store_explicit(&entry->actor, NULL, memory_order_relaxed);
+    atomic_store_explicit(&entry->released_id, next_generation(actor_id), memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ad->released, memory_order_relaxed);
+    uint64_t next;
+    do{
+        atomic_store_explicit(&entry->next_released, (uint32_t) head, memory_order_relaxed);
+        next = (head & ~(uint64_t) UINT32_MAX) + ((uint64_t) 1 << 32) + (uint64_t) slot + 1;
+    } while(!atomic_compare_exchange_weak_explicit(&ad->released, &head, next,
+                                                   memory_order_release, memory_order_relaxed));
+}
+
+actor_group_t* new_actor_group(){
+    actor_group_t* res = malloc(sizeof(actor_group_t));
+    pthread_mutex_init(&res->mutex, NULL);
+    res->capacity = 4;
+    res->count = 0;
+    res->members = malloc(res->capacity * sizeof(actor_id_t));
+    res->scheduled = malloc(res->capacity * sizeof(actor_id_t));
     return res;
 }
 
-void actors_vector_insert(actors_vector* av, actor_info* ai){
-    pthread_mutex_lock(av->mutex);
-    if(av->total == av->occupied){
-        av->actors = realloc(av->actors, 2 * av->total * sizeof(actor_info*));
-        av->total *= 2;
+void destroy_actor_group(actor_group_t* group){
+    pthread_mutex_destroy(&group->mutex);
+    free(group->members);
+    free(group->scheduled);
+    free(group);
+}
+
+void actor_group_insert(actor_group_t* group, actor_id_t actor){
+    for(size_t i = 0; i < group->count; i++){
+        if(group->members[i] == actor) return;
+    }
+    if(group->count == group->capacity){
+        group->capacity *= 2;
+        group->members = realloc(group->members, group->capacity * sizeof(actor_id_t));
+        group->scheduled = realloc(group->scheduled, group->capacity * sizeof(actor_id_t));
     }
-    av->actors[av->occupied] = ai;
-    av->occupied += 1;
-    pthread_mutex_unlock(av->mutex);
+    group->members[group->count++] = actor;
+}
+
+void actor_group_erase(actor_group_t* group, size_t index){
+    group->count -= 1;
+    group->members[index] = group->members[group->count];
 }
 
 void message_queue_push(message_queue* mq , actor_id_t new_el){
@@ -188,13 +869,11 @@ void message_queue_push(message_queue* mq , actor_id_t new_el){
         mq->occupied += 1;
         if(mq->size == mq->occupied) mq->full = true;
     }
-    pthread_cond_signal(mq->actor_cond);
 }
 
-actor_id_t message_queue_pop(global_data_t* global_data){
-    message_queue* mq = global_data->message_q;
+actor_id_t message_queue_pop(global_data_t* global_data, message_queue* mq){
     if(global_data->finished){
-        return 0;
+        return WORK_DEQUE_EMPTY;
     }
     actor_id_t res = mq->messages[mq->start];
     mq->start += 1;
@@ -208,6 +887,86 @@ bool message_queue_empty(message_queue* mq){
     return mq->occupied == 0;
 }
 
+// Replaces the deque's buffer with one twice as large. Only called by the owner.
+work_deque_array* grow_work_deque(work_deque* wd, work_deque_array* array, long top, long bottom){
+    work_deque_array* res = new_work_deque_array(2 * array->size);
+    for(long i = top; i < bottom; i++){
+        atomic_store_explicit(&res->buffer[i % res->size],
+                atomic_load_explicit(&array->buffer[i % array->size], memory_order_relaxed),
+                memory_order_relaxed);
+    }
+    res->previous = array;
+    atomic_store_explicit(&wd->array, res, memory_order_release);
+    return res;
+}
+
+// The memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory Models"
+// by Le, Pop, Cohen and Zappa Nardelli.
+void work_deque_push(work_deque* wd, actor_id_t new_el){
+    long bottom = atomic_load_explicit(&wd->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&wd->top, memory_order_acquire);
+    work_deque_array* array = atomic_load_explicit(&wd->array, memory_order_relaxed);
+    if(bottom - top > array->size - 1){
+        array = grow_work_deque(wd, array, top, bottom);
+    }
+    atomic_store_explicit(&array->buffer[bottom % array->size], new_el, memory_order_relaxed);
+    // A release store rather than the paper's release fence: the same ordering, but visible
+    // to the thread sanitizer, which does not model fences.
+    atomic_store_explicit(&wd->bottom, bottom + 1, memory_order_release);
+}
+
+actor_id_t work_deque_pop(work_deque* wd){
+    long bottom = atomic_load_explicit(&wd->bottom, memory_order_relaxed) - 1;
+    work_deque_array* array = atomic_load_explicit(&wd->array, memory_order_relaxed);
+    atomic_store_explicit(&wd->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&wd->top, memory_order_relaxed);
+    actor_id_t res = WORK_DEQUE_EMPTY;
+    if(top <= bottom){
+        res = atomic_load_explicit(&array->buffer[bottom % array->size], memory_order_relaxed);
+        if(top == bottom){
+            // The last element, a thief may be trying to take it too.
+            if(!atomic_compare_exchange_strong_explicit(&wd->top, &top, top + 1,
+                    memory_order_seq_cst, memory_order_relaxed)){
+                res = WORK_DEQUE_EMPTY;
+            }
+            atomic_store_explicit(&wd->bottom, bottom + 1, memory_order_relaxed);
+        }
+    }
+    else{
+        atomic_store_explicit(&wd->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return res;
+}
+
+actor_id_t work_deque_steal(work_deque* wd){
+    long top = atomic_load_explicit(&wd->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&wd->bottom, memory_order_acquire);
+    actor_id_t res = WORK_DEQUE_EMPTY;
+    if(top < bottom){
+        work_deque_array* array = atomic_load_explicit(&wd->array, memory_order_acquire);
+        res = atomic_load_explicit(&array->buffer[top % array->size], memory_order_relaxed);
+        if(!atomic_compare_exchange_strong_explicit(&wd->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)){
+            return WORK_DEQUE_ABORT;
+        }
+    }
+    return res;
+}
+
+bool work_deque_empty(work_deque* wd){
+    long top = atomic_load(&wd->top);
+    long bottom = atomic_load(&wd->bottom);
+    return bottom <= top;
+}
+
+long work_deque_size(work_deque* wd){
+    long bottom = atomic_load_explicit(&wd->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&wd->top, memory_order_relaxed);
+    return bottom > top ? bottom - top : 0;
+}
+
 message_t new_message(message_type_t mes_type, size_t mes_size, void* mes_data){
     message_t res;
     res.message_type = mes_type;
@@ -216,23 +975,153 @@ message_t new_message(message_type_t mes_type, size_t mes_size, void* mes_data){
     return res;
 }
 
+timer_wheel* new_timer_wheel(){
+    timer_wheel* res = malloc(sizeof(timer_wheel));
+    for(int i = 0; i < TIMER_WHEEL_LEVELS; i++){
+        for(int j = 0; j < TIMER_WHEEL_SLOTS; j++) res->slots[i][j] = NULL;
+    }
+    res->now = 0;
+    clock_gettime(CLOCK_MONOTONIC, &res->start);
+    res->entries = NULL;
+    res->capacity = 0;
+    res->used = 0;
+    res->free = NULL;
+    res->armed = 0;
+    res->mutex = new_mutex();
+    res->cond = new_monotonic_cond();
+    res->running = false;
+    res->stopping = false;
+    return res;
+}
 
-sigset_t new_sigint_set(){
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGINT);
-    return set;
+void destroy_timer_wheel(timer_wheel* tw){
+    for(long i = 0; i < tw->used; i++){
+        timer_entry* te = tw->entries[i];
+        if(te->armed && te->message.message_type == MSG_SPAWN) destroy_role(te->message.data);
+        free(te);
+    }
+    free(tw->entries);
+    destroy_mutex(tw->mutex);
+    free(tw->mutex);
+    pthread_cond_destroy(tw->cond);
+    free(tw->cond);
+    free(tw);
 }
 
-void sort_descriptors(pthread_t* thread_descriptors){
-    pthread_t temp;
-    for(int i = 0; i < POOL_SIZE; i++){
-        for(int j = 0; j < POOL_SIZE-i-1; j++){
-            if(thread_descriptors[j] > thread_descriptors[j+1]){
-                temp = thread_descriptors[j];
-                thread_descriptors[j] = thread_descriptors[j+1];
-                thread_descriptors[j+1] = temp;
-            }
+timer_entry* timer_wheel_acquire(timer_wheel* tw){
+    timer_entry* res = tw->free;
+    if(res != NULL){
+        tw->free = res->next;
+        return res;
+    }
+    if(tw->used == tw->capacity){
+        tw->capacity = tw->capacity == 0 ? 16 : 2 * tw->capacity;
+        tw->entries = realloc(tw->entries, tw->capacity * sizeof(timer_entry*));
+    }
+    res = malloc(sizeof(timer_entry));
+    res->id = tw->used;
+    res->armed = false;
+    tw->entries[tw->used++] = res;
+    return res;
+}
+
+void timer_wheel_release(timer_wheel* tw, timer_entry* te){
+    te->id += (timer_id_t) 1 << TIMER_SLOT_BITS;
+    te->next = tw->free;
+    tw->free = te;
+}
+
+timer_entry* timer_wheel_find(timer_wheel* tw, timer_id_t id){
+    if(id < 0 || timer_slot(id) >= tw->used) return NULL;
+    timer_entry* res = tw->entries[timer_slot(id)];
+    return res->id == id && res->armed ? res : NULL;
+}
+
+void timer_wheel_add(timer_wheel* tw, timer_entry* te){
+    uint64_t deadline = te->deadline < tw->now ? tw->now : te->deadline;
+    uint64_t limit = ((uint64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    if(deadline - tw->now > limit) deadline = tw->now + limit;
+    int level = 0;
+    while(level < TIMER_WHEEL_LEVELS - 1 &&
+            deadline - tw->now >= (uint64_t) 1 << (TIMER_WHEEL_BITS * (level + 1))){
+        level++;
+    }
+    te->slot = &tw->slots[level][(deadline >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    te->previous = NULL;
+    te->next = *te->slot;
+    if(te->next != NULL) te->next->previous = te;
+    *te->slot = te;
+    te->armed = true;
+    tw->armed += 1;
+}
+
+void timer_wheel_remove(timer_wheel* tw, timer_entry* te){
+    if(te->previous != NULL) te->previous->next = te->next;
+    else *te->slot = te->next;
+    if(te->next != NULL) te->next->previous = te->previous;
+    te->armed = false;
+    tw->armed -= 1;
+}
+
+// Takes all the timers out of the slot, disarmed.
+timer_entry* timer_wheel_take(timer_wheel* tw, timer_entry** slot){
+    timer_entry* res = *slot;
+    *slot = NULL;
+    for(timer_entry* te = res; te != NULL; te = te->next){
+        te->armed = false;
+        tw->armed -= 1;
+    }
+    return res;
+}
+
+timer_entry* timer_wheel_advance(timer_wheel* tw){
+    for(int level = 1; level < TIMER_WHEEL_LEVELS; level++){
+        if((tw->now & (((uint64_t) 1 << (TIMER_WHEEL_BITS * level)) - 1)) != 0) break;
+        timer_entry** slot = &tw->slots[level][(tw->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+        timer_entry* te = timer_wheel_take(tw, slot);
+        while(te != NULL){
+            timer_entry* next = te->next;
+            timer_wheel_add(tw, te);
+            te = next;
+        }
+    }
+    timer_entry* res = timer_wheel_take(tw, &tw->slots[0][tw->now & (TIMER_WHEEL_SLOTS - 1)]);
+    tw->now += 1;
+    return res;
+}
+
+io_reactor* new_reactor(){
+    io_reactor* res = malloc(sizeof(io_reactor));
+    res->epoll_fd = -1;
+    res->wake_fd = -1;
+    res->watches = NULL;
+    res->capacity = 0;
+    res->pending = 0;
+    res->mutex = new_mutex();
+    res->running = false;
+    res->stopping = false;
+    return res;
+}
+
+void destroy_reactor(io_reactor* r){
+    if(r->epoll_fd >= 0) close(r->epoll_fd);
+    if(r->wake_fd >= 0) close(r->wake_fd);
+    free(r->watches);
+    destroy_mutex(r->mutex);
+    free(r->mutex);
+    free(r);
+}
+
+io_watch* reactor_watch(io_reactor* r, int fd){
+    if(fd >= r->capacity){
+        int capacity = r->capacity > 0 ? r->capacity : 64;
+        while(capacity <= fd) capacity *= 2;
+        r->watches = realloc(r->watches, capacity * sizeof(io_watch));
+        for(int i = r->capacity; i < capacity; i++){
+            r->watches[i].actor = -1;
+            r->watches[i].pending = 0;
         }
+        r->capacity = capacity;
     }
+    return &r->watches[fd];
 }
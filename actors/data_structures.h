@@ -1,97 +1,648 @@
-
-#ifndef CACTI_DATA_STRUCTURES_H
-#define CACTI_DATA_STRUCTURES_H
-
-#include <pthread.h>
-#include <stdlib.h>
-#include <stdbool.h>
-#include <signal.h>
-
-#include "cacti.h"
-
-// A global queue of actors waiting to be executed by threads,
-// implemented as a cyclic buffer with dynamic size.
-typedef struct message_queue_s{
-    pthread_cond_t* actor_cond;
-    pthread_mutex_t* mutex;
-    actor_id_t * messages;
-    int size;
-    int start;
-    int occupied;
-    bool full;
-} message_queue;
-
-// A blocking queue implemented as a cyclic buffer with a set size,
-// storing messages sent to a given actor.
-typedef struct blocking_queue_s{
-    pthread_mutex_t* mutex;
-    size_t size;
-    message_t* buffer;
-    size_t start;
-    size_t end;
-    bool full;
-} blocking_queue;
-
-typedef struct actor_info_s{
-    actor_id_t actor_id;
-    void* stateptr;
-    pthread_mutex_t* mutex;
-    bool dead;
-    bool waiting; // for a working thread to take care of its current task
-    role_t* role;
-    blocking_queue* messages;
-} actor_info;
-
-typedef struct actors_vector_s{
-    pthread_mutex_t* mutex;
-    actor_id_t total;
-    actor_id_t occupied;
-    actor_info** actors;
-} actors_vector;
-
-typedef struct global_data_s{
-    actor_id_t num_of_actors;
-    actor_id_t alive_actors;
-    actors_vector* actors;
-    message_queue* message_q;
-    pthread_mutex_t* mutex;
-    bool started;
-    bool finished;
-    pthread_cond_t* started_cond;
-    pthread_cond_t* thread_join_cond;
-    pthread_cond_t* sigint_cond;
-    pthread_t* thread_descriptors;
-    actor_id_t* thread_to_actor; // maps thread IDs to the currently executed actors. Sorted, and binsearched if needed.
-    int finished_threads;
-    pthread_t director_id;
-} global_data_t;
-
-actor_info* new_actor_info(void *const role, actor_id_t actor_id);
-
-void destroy_system(global_data_t* global);
-
-void initialize_global_data(global_data_t* global_data);
-
-message_t bl_queue_pop(blocking_queue* bq);
-
-// Fails if the queue's cyclic buffer is full.
-bool bl_queue_push(blocking_queue* bq, message_t new_el);
-
-bool bl_queue_empty(blocking_queue* bq);
-
-void actors_vector_insert(actors_vector* av, actor_info* ai);
-
-void message_queue_push(message_queue* mq, actor_id_t new_el);
-
-actor_id_t message_queue_pop(global_data_t* global_data);
-
-bool message_queue_empty(message_queue* mq);
-
-message_t new_message(message_type_t mes_type, size_t mes_size, void* mes_data);
-
-sigset_t new_sigint_set();
-
-void sort_descriptors(pthread_t* thread_descriptors);
-
-
-#endif //CACTI_DATA_STRUCTURES_H
+#ifndef CACTI_DATA_STRUCTURES_H
+#define CACTI_DATA_STRUCTURES_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cacti.h"
+
+#if CACTI_TRACE && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// A global queue of actors waiting to be executed by threads,
+// implemented as a cyclic buffer with dynamic size.
+typedef struct message_queue_s{
+    pthread_mutex_t* mutex;
+    actor_id_t * messages;
+    int size;
+    int start;
+    atomic_int occupied; // also read without the mutex, to tell whether the queue is empty
+    bool full;
+} message_queue;
+
+#define WORK_DEQUE_EMPTY (actor_id_t)-1
+#define WORK_DEQUE_ABORT (actor_id_t)-2
+
+// The cyclic buffer of a work-stealing deque. Buffers replaced during growth are kept
+// until the deque is destroyed, as a concurrent thief may still be reading from them.
+typedef struct work_deque_array_s{
+    long size;
+    _Atomic(actor_id_t)* buffer;
+    struct work_deque_array_s* previous;
+} work_deque_array;
+
+// A Chase-Lev deque of actors waiting to be executed, owned by a single working thread.
+// The owner pushes and pops at the bottom without locking, other threads steal from the top.
+typedef struct work_deque_s{
+    _Atomic long top;
+    _Atomic long bottom;
+    _Atomic(work_deque_array*) array;
+} work_deque;
+
+// How a message's payload is passed: as the sender's pointer, copied into the slot,
+// or as a pointer to a shared_payload multicast to a group.
+typedef enum{
+    MAILBOX_POINTER,
+    MAILBOX_INLINE,
+    MAILBOX_SHARED
+} payload_kind;
+
+// A payload of up to MESSAGE_INLINE_SIZE bytes may be copied into the slot instead of being
+// passed by pointer. With the default size a slot takes exactly one cache line, unless
+// metrics are collected.
+typedef struct mailbox_slot_s{
+    atomic_size_t sequence;
+    message_type_t message_type;
+    size_t nbytes;
+    unsigned char kind; // a payload_kind
+#if CACTI_METRICS
+    uint64_t sent; // by metrics_clock
+#endif
+    union{
+        void* data;
+        unsigned char payload[MESSAGE_INLINE_SIZE];
+    };
+} mailbox_slot;
+
+// Slots held directly in the queue, and the size of the segments allocated when they run out.
+#define MAILBOX_INLINE_SIZE 4
+#define MAILBOX_SEGMENT_SIZE 64
+
+#define MAILBOX_SEGMENTS ((ACTOR_QUEUE_LIMIT + MAILBOX_SEGMENT_SIZE - 1) / MAILBOX_SEGMENT_SIZE)
+
+// Set in the end position while the consumer is freeing the segments of an empty queue.
+#define MAILBOX_SHRINKING ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+
+// A lock-free queue implemented as a cyclic buffer with a set size, storing messages sent
+// to a given actor. Any thread may push, but only the working thread currently executing
+// the actor pops. Every slot carries a sequence number telling whether it is free for
+// the push at a given position or holds the message to be popped from it.
+// Only the first few slots of the buffer are stored inline, the rest is split into segments
+// allocated when a push first reaches them and freed once the queue is drained again.
+typedef struct blocking_queue_s{
+    size_t size;
+    size_t inline_size;
+    atomic_size_t start;
+    atomic_size_t end;
+    atomic_size_t shrink_position; // where the queue was last drained and its segments freed
+    atomic_int allocated_segments;
+#if CACTI_METRICS
+    atomic_size_t high_water; // the most positions ever reserved at once
+#endif
+    mailbox_slot inline_slots[MAILBOX_INLINE_SIZE];
+    _Atomic(mailbox_slot*) segments[MAILBOX_SEGMENTS];
+} blocking_queue;
+
+// A message waiting in an actor's priority lane, in a message pool buffer. An inlined payload
+// is copied after it, and the message points to the copy.
+typedef struct priority_message_s{
+    struct priority_message_s* next;
+    message_t message;
+    payload_kind kind;
+#if CACTI_METRICS
+    uint64_t sent;
+#endif
+    _Alignas(max_align_t) unsigned char payload[];
+} priority_message;
+
+// System messages, and the ones sent with send_message_priority, skip the actor's queue:
+// they are executed before any message waiting there, in the order in which they were sent.
+// Senders push onto a lock-free stack, which the thread executing the actor takes over as
+// a whole and reverses once it runs out of the messages taken before. The lane is not
+// bounded, as such messages are rare.
+typedef struct priority_lane_s{
+    _Atomic(priority_message*) pushed;
+    priority_message* taken; // only touched by the thread executing the actor
+} priority_lane;
+
+// A message sent from a prompt with send_message_wait or send_message_timed, which did not
+// fit in its receiver's queue. It counts among the receiver's blocked senders.
+typedef struct deferred_send_s{
+    struct deferred_send_s* next;
+    actor_id_t receiver;
+    struct actor_info_s* receiver_info;
+    message_t message;
+    bool timed;
+    struct timespec deadline;
+} deferred_send;
+
+// An actor with deferred sends is stalled: it executes no further messages until they are
+// all delivered, but its working thread goes on with other actors meanwhile, retrying the
+// deliveries now and then. The record exists only while there are deferred sends, and is
+// only touched by the thread executing the actor, or holding it stalled.
+typedef struct stall_s{
+    deferred_send* first;
+    deferred_send* last;
+    struct actor_info_s* next_stalled; // in the list of the thread holding the actor
+} stall;
+
+// How often blocked senders check for room in case they missed a wakeup, and how often
+// an idle working thread retries the deferred sends of its stalled actors.
+#define BACKPRESSURE_RETRY_USEC 1000
+
+// Actor records are carved out of slab chunks, aligned to cache lines
+// so that actors executed by different threads do not share them.
+// A dead actor's record is reclaimed once its queue is drained. A sender holding its stale
+// ID may still be looking at the record then, so senders register in the senders counter
+// while they check the ID and push, and the record is not released or reused until it drops
+// to zero. As records are only ever reused as records, such a late look is harmless.
+typedef struct actor_info_s{
+    _Alignas(64) _Atomic actor_id_t actor_id;
+    void* stateptr;
+    atomic_bool dead;
+    atomic_bool waiting; // queued for, or being executed by, a working thread
+    atomic_int senders;
+    atomic_int blocked_senders; // senders waiting for room in the queue, never reset either
+    int home; // the NUMA node of the thread which spawned the actor, -1 if unknown
+    struct stall_s* stall; // NULL unless the actor has deferred sends
+    role_t* role;
+    struct actor_info_s* next_free; // in the slab, once the record is released
+#if CACTI_METRICS
+    atomic_ulong executed; // only written by the thread executing the actor
+#endif
+    priority_lane priority;
+    blocking_queue messages;
+} actor_info;
+
+#define ACTOR_SLAB_CHUNK 256
+
+typedef struct slab_chunk_s{
+    struct slab_chunk_s* next;
+    bool mapped; // with mmap, bound to the slab's node, rather than with malloc
+    actor_info actors[ACTOR_SLAB_CHUNK];
+} slab_chunk;
+
+// Hands out actor records carved from large chunks, and reuses the released ones.
+// A slab is not synchronized: every working thread has its own, while threads outside
+// the pool share one guarded by the global mutex.
+typedef struct actor_slab_s{
+    int node; // the NUMA node new chunks are placed on, -1 for any
+    slab_chunk* chunks;
+    size_t carved; // records handed out from the newest chunk
+    actor_info* free;
+} actor_slab;
+
+// The largest CPU number threads may be pinned to, and the largest NUMA node memory
+// may be bound to, plus one.
+#define AFFINITY_MAX_CPUS 1024
+#define AFFINITY_MAX_NODES 64
+
+// Message payload buffers are handed out in power-of-two size classes, from
+// MESSAGE_POOL_MIN_SIZE bytes up to MESSAGE_POOL_MIN_SIZE << (MESSAGE_POOL_CLASSES - 1).
+#define MESSAGE_POOL_MIN_SIZE 16
+#define MESSAGE_POOL_CLASSES 9
+
+// Precedes every payload buffer. While the buffer is handed out, it points to the pool
+// the buffer belongs to, which may be another system's, or is NULL for a buffer allocated
+// directly with malloc.
+typedef struct message_buffer_s{
+    _Alignas(16) union{
+        struct message_buffer_s* next; // in a free list or a remote free queue
+        struct message_pool_s* pool;
+    };
+    int size_class;
+} message_buffer;
+
+// The free buffers of a working thread, one list per size class, only ever touched by that
+// thread. Other threads return the buffers they free to the remote queue, which the owner
+// takes over as a whole when a list runs out, so there is no ABA problem.
+typedef struct message_pool_s{
+    message_buffer* free[MESSAGE_POOL_CLASSES];
+    _Alignas(64) _Atomic(message_buffer*) remote;
+} message_pool;
+
+// Precedes a payload multicast to a group. Every member it is delivered to holds a reference,
+// dropped once its prompt returns, and so does the sender until it has delivered it to all.
+typedef struct shared_payload_s{
+    _Alignas(16) atomic_long references;
+} shared_payload;
+
+struct actor_group{
+    struct actor_system_s* system; // the one the group was created in
+    pthread_mutex_t mutex;
+    actor_id_t* members;
+    actor_id_t* scheduled; // the members scheduled by the multicast in progress
+    size_t count;
+    size_t capacity;
+};
+
+// An actor ID consists of the index of the actor's slot in the actors directory, and of the
+// slot's generation, incremented whenever the slot is reused after its actor is reclaimed.
+#define ACTOR_SLOT_BITS 32
+#define actor_slot(id) ((id) & (((actor_id_t) 1 << ACTOR_SLOT_BITS) - 1))
+#define next_generation(id) ((id) + ((actor_id_t) 1 << ACTOR_SLOT_BITS))
+
+#define DIRECTORY_SEGMENT_BITS 12
+#define DIRECTORY_SEGMENT_SIZE ((actor_id_t) 1 << DIRECTORY_SEGMENT_BITS)
+#define DIRECTORY_SEGMENTS ((CAST_LIMIT + DIRECTORY_SEGMENT_SIZE - 1) / DIRECTORY_SEGMENT_SIZE)
+
+typedef struct directory_entry_s{
+    _Atomic(actor_info*) actor; // NULL until the actor is set, and after it is reclaimed
+    _Atomic actor_id_t released_id; // the ID reusing the slot, while it is released
+    atomic_uint_least32_t next_released; // the next released slot plus one, 0 at the end
+} directory_entry;
+
+// Maps actor slots to actors. The slots live in segments which are allocated on first use
+// and never move, so a lookup only follows two pointers and needs no lock. New slots are
+// appended with a CAS on the number of slots. The slots of reclaimed actors are kept on a
+// stack whose head holds the top slot plus one in its low half, and a counter bumped by every
+// change in its high half, so that a pop racing with a pop and a push of the same slot fails.
+typedef struct actors_directory_s{
+    _Atomic(directory_entry*) segments[DIRECTORY_SEGMENTS];
+    _Atomic actor_id_t occupied; // slots handed out, at most CAST_LIMIT
+    _Atomic uint64_t released;
+} actors_directory;
+
+// A timer ID consists of the index of the timer's entry, and of the entry's generation,
+// incremented whenever the entry is released, so that stale IDs cancel nothing.
+#define TIMER_SLOT_BITS 32
+#define timer_slot(id) ((id) & (((timer_id_t) 1 << TIMER_SLOT_BITS) - 1))
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct timer_entry_s{
+    struct timer_entry_s* next; // in the wheel slot, or in the list of free entries
+    struct timer_entry_s* previous;
+    struct timer_entry_s** slot; // the wheel slot the timer waits in
+    timer_id_t id;
+    actor_id_t actor;
+    message_t message;
+    uint64_t deadline; // in ticks since the wheel was created
+    uint64_t period; // in ticks, 0 for a one-shot timer
+    bool armed;
+} timer_entry;
+
+// A hierarchical timer wheel: a timer due within TIMER_WHEEL_SLOTS ticks waits in a slot of
+// the first level, one due later in a coarser level, whose slots span TIMER_WHEEL_SLOTS
+// times as many ticks each. Whenever a level comes round, the timers in the next slot of
+// the level above are cascaded down. Adding, cancelling and firing a timer take constant time.
+// Timers due beyond the last level wait in its farthest slot and are cascaded again.
+// Guarded by its mutex, and serviced by a timer thread started with the first timer.
+typedef struct timer_wheel_s{
+    timer_entry* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now; // the next tick to process
+    struct timespec start;
+    timer_entry** entries; // indexed by the slots of timer IDs
+    long capacity;
+    long used; // the entries handed out so far, released ones included
+    timer_entry* free;
+    long armed;
+    pthread_mutex_t* mutex;
+    pthread_cond_t* cond; // on CLOCK_MONOTONIC, signalled when a timer is added, or the thread is to stop
+    pthread_t thread;
+    bool running;
+    bool stopping;
+} timer_wheel;
+
+// A descriptor watched by the reactor, at the index of the descriptor.
+typedef struct io_watch_s{
+    actor_id_t actor; // -1 if the descriptor is not watched
+    message_type_t message_type;
+    int pending; // the events received but not sent yet, as the actor's queue was full
+} io_watch;
+
+#define REACTOR_EVENTS 64
+
+// Waits for the readiness of descriptors with epoll, in a reactor thread started with the
+// first watch. The watches are one-shot, so the kernel disarms a descriptor once it is ready,
+// until it is watched again. Guarded by its mutex, which epoll_wait is called without.
+typedef struct io_reactor_s{
+    int epoll_fd; // -1 until the thread is started
+    int wake_fd; // an eventfd, written to when the thread is to stop
+    io_watch* watches;
+    int capacity;
+    int pending; // the watches with pending events
+    pthread_mutex_t* mutex;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+} io_reactor;
+
+#if CACTI_METRICS
+// The metrics of one thread, on cache lines of their own. Only that thread writes them,
+// so it bumps the counters with plain loads and stores, and snapshots read them as they go.
+typedef struct thread_metrics_s{
+    _Alignas(64) atomic_ulong messages;
+    atomic_ulong activations;
+    atomic_ulong steals;
+    atomic_ulong parks;
+    atomic_ulong idle_nsec;
+    atomic_ulong queue_wait[CACTI_METRICS_PROMPTS + 1][CACTI_METRICS_BUCKETS];
+    atomic_ulong run_time[CACTI_METRICS_PROMPTS + 1][CACTI_METRICS_BUCKETS];
+    struct thread_metrics_s* next; // in the list of all the blocking threads' metrics
+    struct thread_metrics_s* next_free; // in the list of those no running thread uses
+} thread_metrics;
+
+// Nanoseconds on the monotonic clock.
+static inline uint64_t metrics_clock(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+
+#if CACTI_TRACE
+typedef enum{
+    TRACE_SEND, // other is the receiver
+    TRACE_ENQUEUE, // other is the receiver, value what push_messages returned
+    TRACE_DISPATCH_START,
+    TRACE_DISPATCH_END,
+    TRACE_SPAWN, // other is the new actor
+    TRACE_DEATH
+} trace_kind;
+
+typedef struct trace_event_s{
+    uint64_t tsc; // by trace_clock
+    actor_id_t actor; // the one executed by the thread, -1 if none
+    actor_id_t other;
+    message_type_t message_type;
+    long value;
+    int kind; // a trace_kind
+} trace_event;
+
+// The latest events of one thread, which is the only one writing them. An event is claimed
+// before it overwrites the oldest one, and published once written, so that a flush taking
+// a copy meanwhile can tell which of the events it has copied were being overwritten.
+typedef struct trace_ring_s{
+    _Alignas(64) atomic_size_t claimed;
+    atomic_size_t head; // the events published so far
+    size_t flushed; // those written out already, guarded by the trace mutex
+    int track; // the thread's ID in the trace
+    struct trace_ring_s* next; // in the list of all the blocking threads' rings
+    struct trace_ring_s* next_free; // in the list of those no running thread uses
+    trace_event events[CACTI_TRACE_EVENTS];
+} trace_ring;
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t trace_clock(){
+    return __rdtsc();
+}
+#else
+static inline uint64_t trace_clock(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+#endif
+#endif
+
+// The actor a working thread executes next, and how many it has taken from there in a row.
+// Only touched by the thread in the slot, each on a cache line of its own.
+typedef struct{
+    _Alignas(64) actor_id_t actor; // WORK_DEQUE_EMPTY if none
+    int streak;
+} run_next_slot;
+
+// An actor system. Everything it uses lives here, so that independent systems can run
+// side by side in one process.
+typedef struct actor_system_s{
+    _Atomic actor_id_t alive_actors; // the actors not reclaimed yet, the system ends with none left
+    actors_directory* actors;
+    // For actors scheduled by threads outside the pool, and ones bumped from a run-next slot.
+    message_queue* message_q;
+    int* worker_cpus; // the CPU of every thread slot, NULL if threads are not pinned
+    int* worker_nodes; // the NUMA node of every thread slot, -1 if unknown
+    int nodes;
+    // With threads on more than one node, one queue per node, for actors scheduled
+    // by threads on other nodes or outside the pool. NULL otherwise.
+    message_queue** node_queues;
+    work_deque** deques; // one per working thread slot
+    actor_slab** slabs; // one per working thread slot, and a shared one at the end
+    message_pool** message_pools; // one per working thread slot
+    struct actor_info_s** stalled; // the lists of stalled actors, one per working thread slot
+    run_next_slot* run_next; // one per working thread slot
+    pthread_mutex_t* backpressure_mutex;
+    pthread_cond_t* space_cond; // broadcast when an actor with blocked senders pops messages
+    // Actors whose next message is for a blocking prompt, waiting for a blocking thread.
+    message_queue* blocking_q;
+    pthread_cond_t* blocking_cond; // signalled when an actor is queued there, or a blocking thread exits
+    int blocking_threads; // running blocking threads, guarded by the mutex of blocking_q
+    int idle_blocking; // those of them waiting for an actor
+#if CACTI_METRICS
+    thread_metrics* metrics; // one per working thread slot, kept by the threads taking the slot over
+    // The blocking threads' metrics, guarded by the mutex of blocking_q. Exiting threads leave
+    // theirs to the threads started later.
+    thread_metrics* blocking_metrics;
+    thread_metrics* free_metrics;
+#endif
+#if CACTI_TRACE
+    _Atomic(trace_ring*)* traces; // one per working thread slot, allocated as a thread first takes it
+    trace_ring* blocking_traces; // guarded by the mutex of blocking_q, like the blocking metrics
+    trace_ring* free_traces;
+    int blocking_tracks; // handed out to the blocking threads' rings so far
+    trace_ring* outside_trace; // shared by the threads outside the system, guarded by the trace mutex
+    pthread_mutex_t* trace_mutex; // also held by flushes
+    uint64_t trace_start_tsc; // when the system was created, to calibrate trace_clock
+    struct timespec trace_start;
+#endif
+    timer_wheel* timers;
+    io_reactor* reactor;
+    atomic_int idle_threads; // threads in wait_for_work, spinning or parked
+    atomic_int parked_threads; // those of them asleep on idle_futex
+    atomic_uint idle_futex; // bumped whenever parked threads are woken up
+    pthread_mutex_t* mutex;
+    bool started;
+    atomic_bool finished;
+    bool stopping; // set once the system is to finish: its actors are all dead, or SIGINT came
+    atomic_int actor_joiners; // threads in cacti_actor_join
+    pthread_cond_t* started_cond;
+    pthread_cond_t* thread_join_cond;
+    // Broadcast when stopping is set, and when an actor is reclaimed while somebody joins one.
+    pthread_cond_t* finish_cond;
+    struct actor_system_s* next_interruptible; // in the list of systems finished by SIGINT
+    actor_system_config_t config;
+    atomic_size_t throughput_messages; // the current quantum, starting from the config's
+    atomic_long throughput_usec;
+    int pool_capacity; // the number of thread slots, config.max_workers
+    atomic_bool* thread_slots; // whether a slot is taken by a running thread
+    atomic_int active_threads; // running threads, apart from those already exiting
+    atomic_flag growing;
+    actor_id_t* thread_to_actor; // maps thread slots to the currently executed actors
+    int running_threads;
+    pthread_t director_id;
+} global_data_t;
+
+// What a new working thread needs to know. Freed by the thread once it starts.
+typedef struct worker_start_s{
+    global_data_t* global_data;
+    int slot;
+} worker_start;
+
+actor_info* new_actor_info(actor_slab* slab, void *const role, actor_id_t actor_id);
+
+void destroy_system(global_data_t* global);
+
+void destroy_actor_info(actor_info* ai);
+
+void destroy_role(role_t* role);
+
+void destroy_stall(stall* st);
+
+actor_info* actor_slab_alloc(actor_slab* slab);
+
+void actor_slab_free(actor_slab* slab, actor_info* ai);
+
+// Returns a payload buffer of at least nbytes, from the pool of the given working thread slot,
+// or allocated with malloc if the slot is negative or the buffer is too large for the pool.
+void* message_pool_alloc(global_data_t* global_data, int owner, size_t nbytes);
+
+// Returns the buffer to its pool: directly if it belongs to the calling thread, through
+// the owner's remote queue otherwise. The caller is a slot of the given system.
+void message_pool_free(global_data_t* global_data, int caller, void* buffer);
+
+void initialize_global_data(global_data_t* global_data, const actor_system_config_t* config);
+
+// May only be called by the working thread executing the queue's actor, on a non-empty queue.
+// An inlined payload is copied to the given buffer of MESSAGE_INLINE_SIZE bytes, and the
+// message points to it.
+message_t bl_queue_pop(blocking_queue* bq, void* payload, payload_kind* kind);
+
+// Fails if the queue's cyclic buffer is full. For MAILBOX_INLINE, the message's data points
+// to a payload of nbytes, at most MESSAGE_INLINE_SIZE, which is copied into the queue.
+bool bl_queue_push(blocking_queue* bq, message_t new_el, payload_kind kind);
+
+// Pushes as many of the messages as fit, in order, with a single reservation, so that
+// no other push is interleaved with them. Returns the number pushed.
+size_t bl_queue_push_many(blocking_queue* bq, const message_t* new_els, size_t count, payload_kind kind);
+
+// A message which is being pushed concurrently may not be visible yet.
+// May only be called by the working thread executing the queue's actor.
+bool bl_queue_empty(blocking_queue* bq);
+
+// Whether no position has been reserved since the last pop. Unlike bl_queue_empty, it may be
+// called by a thread which is not executing the queue's actor.
+bool bl_queue_unpushed(blocking_queue* bq);
+
+// The type of the message bl_queue_pop would return next. May only be called by the
+// working thread executing the queue's actor, on a non-empty queue.
+message_type_t bl_queue_front_type(blocking_queue* bq);
+
+#if CACTI_METRICS
+// When the message bl_queue_pop would return next was pushed, with the same restrictions.
+uint64_t bl_queue_front_sent(blocking_queue* bq);
+#endif
+
+// The number of reserved positions, an estimate which any thread may take.
+size_t bl_queue_depth(blocking_queue* bq);
+
+// Frees the queue's segments if it is empty, and moves it back to its inline slots.
+// May only be called by the working thread executing the queue's actor.
+// Pushes wait while it is in progress.
+void bl_queue_shrink(blocking_queue* bq);
+
+void priority_lane_push(priority_lane* pl, priority_message* new_el);
+
+// May only be called by the working thread executing the lane's actor.
+// Returns NULL if the lane is empty.
+priority_message* priority_lane_pop(priority_lane* pl);
+
+// Like priority_lane_pop, but leaves the message in the lane.
+priority_message* priority_lane_peek(priority_lane* pl);
+
+// May only be called by the working thread executing the lane's actor.
+bool priority_lane_empty(priority_lane* pl);
+
+bool priority_lane_unpushed(priority_lane* pl);
+
+// Returns an ID for a new actor, reusing the slot of a reclaimed actor if there is one,
+// or -1 if there are CAST_LIMIT slots in use already.
+actor_id_t actors_directory_reserve(actors_directory* ad);
+
+// Stores the actor in the slot of its ID, after it is fully initialized.
+void actors_directory_set(actors_directory* ad, actor_info* ai);
+
+// Returns the actor in the slot of the ID, which may be NULL, or may be a newer actor
+// reusing the slot. Wait-free.
+actor_info* actors_directory_get(actors_directory* ad, actor_id_t actor_id);
+
+// The number of slots handed out so far.
+actor_id_t actors_directory_size(actors_directory* ad);
+
+// Frees the slot of a reclaimed actor.
+void actors_directory_release(actors_directory* ad, actor_id_t actor_id);
+
+actor_group_t* new_actor_group();
+
+void destroy_actor_group(actor_group_t* group);
+
+// Adds the actor unless it is a member already. Called with the group's mutex held.
+void actor_group_insert(actor_group_t* group, actor_id_t actor);
+
+// Removes the member at the given index, moving the last member in its place.
+// Called with the group's mutex held.
+void actor_group_erase(actor_group_t* group, size_t index);
+
+void message_queue_push(message_queue* mq, actor_id_t new_el);
+
+message_queue* new_message_queue();
+
+// Returns WORK_DEQUE_EMPTY once the system has finished, whatever the queue holds.
+actor_id_t message_queue_pop(global_data_t* global_data, message_queue* mq);
+
+bool message_queue_empty(message_queue* mq);
+
+// May only be called by the owner of the deque.
+void work_deque_push(work_deque* wd, actor_id_t new_el);
+
+// May only be called by the owner of the deque. Returns WORK_DEQUE_EMPTY if there is nothing to pop.
+actor_id_t work_deque_pop(work_deque* wd);
+
+// Returns WORK_DEQUE_EMPTY if there is nothing to steal, or WORK_DEQUE_ABORT
+// if the steal lost a race with another thread and may be retried.
+actor_id_t work_deque_steal(work_deque* wd);
+
+bool work_deque_empty(work_deque* wd);
+
+// An estimate, as the deque may be changed concurrently.
+long work_deque_size(work_deque* wd);
+
+message_t new_message(message_type_t mes_type, size_t mes_size, void* mes_data);
+
+timer_wheel* new_timer_wheel();
+
+// The messages of the timers still armed are dropped, apart from the roles of spawn requests.
+void destroy_timer_wheel(timer_wheel* tw);
+
+// Returns an unarmed entry with a fresh ID.
+timer_entry* timer_wheel_acquire(timer_wheel* tw);
+
+// Makes the entry's ID stale, and lets the entry be reused.
+void timer_wheel_release(timer_wheel* tw, timer_entry* te);
+
+// Returns the entry with the given ID, or NULL if the ID is stale.
+timer_entry* timer_wheel_find(timer_wheel* tw, timer_id_t id);
+
+// Arms the entry, whose deadline is set. A deadline which has passed fires with the next tick.
+void timer_wheel_add(timer_wheel* tw, timer_entry* te);
+
+void timer_wheel_remove(timer_wheel* tw, timer_entry* te);
+
+// Processes the next tick, and returns the timers it fires, disarmed and linked through next.
+timer_entry* timer_wheel_advance(timer_wheel* tw);
+
+#if CACTI_METRICS
+// Zeroed, on cache lines of its own.
+thread_metrics* new_thread_metrics();
+#endif
+
+#if CACTI_TRACE
+trace_ring* new_trace_ring(int track);
+#endif
+
+io_reactor* new_reactor();
+
+// Closes the reactor's descriptors, but not the watched ones.
+void destroy_reactor(io_reactor* r);
+
+// Returns the entry of the descriptor, growing the table if needed.
+io_watch* reactor_watch(io_reactor* r, int fd);
+
+#endif //CACTI_DATA_STRUCTURES_H
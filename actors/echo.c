@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "cacti.h"
+
+// A sample echo server, whose actors are woken up by the reactor when their sockets are ready.
+// The main thread is the client: it connects over local socket pairs and checks the echoes.
+// To execute, a command like "./echo 4 1000" can be used, for 4 connections of 1000 lines each.
+
+#define ECHO_BUFFER 4096
+
+typedef struct{
+    actor_id_t server;
+    int fd;
+    size_t pending; // bytes read but not written back yet
+    char buffer[ECHO_BUFFER];
+}connection;
+
+typedef struct{
+    int* fds; // handed out to the connection actors in the order they are spawned
+    int connections;
+    int handed_out;
+    int closed;
+}server;
+
+void hello(void **stateptr, size_t nbytes, void* data);
+
+void serve(void **stateptr, size_t nbytes, void* data);
+
+void receive_hello_response(void **stateptr, size_t nbytes, void* data);
+
+void connect_socket(void **stateptr, size_t nbytes, void* data);
+
+void handle_io(void **stateptr, size_t nbytes, void* data);
+
+void receive_closed(void **stateptr, size_t nbytes, void* data);
+
+#define MSG_SERVE 1
+#define MSG_HELLO_RESPONSE 2
+#define MSG_CONNECT 3
+#define MSG_IO 4
+#define MSG_CLOSED 5
+
+role_t* new_role(){
+    role_t* res = malloc(sizeof(role_t));
+    res->nprompts = 6;
+    void** prompts = malloc(6 * sizeof(act_t));
+    prompts[0] = &hello;
+    prompts[MSG_SERVE] = &serve;
+    prompts[MSG_HELLO_RESPONSE] = &receive_hello_response;
+    prompts[MSG_CONNECT] = &connect_socket;
+    prompts[MSG_IO] = &handle_io;
+    prompts[MSG_CLOSED] = &receive_closed;
+    res->prompts = (act_t*) prompts;
+    return res;
+}
+
+message_t new_message_of(message_type_t type, void* data){
+    message_t res;
+    res.message_type = type;
+    res.nbytes = sizeof(data);
+    res.data = data;
+    return res;
+}
+
+void commit_suicide(){
+    send_message(actor_id_self(), new_message_of(MSG_GODIE, NULL));
+}
+
+// A connection actor introduces itself to the server, which then hands it a socket.
+void hello(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    connection* conn = malloc(sizeof(connection));
+    conn->server = *((actor_id_t*) data);
+    conn->fd = -1;
+    conn->pending = 0;
+    *stateptr = conn;
+    free(data);
+    actor_id_t ait = actor_id_self();
+    send_message_inline(conn->server, MSG_HELLO_RESPONSE, &ait, sizeof(actor_id_t));
+}
+
+// The server spawns one connection actor per socket.
+void serve(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    server* srv = data;
+    *stateptr = srv;
+    for(int i = 0; i < srv->connections; i++){
+        send_message(actor_id_self(), new_message_of(MSG_SPAWN, new_role()));
+    }
+}
+
+void receive_hello_response(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    server* srv = *stateptr;
+    actor_id_t child = *((actor_id_t*) data);
+    int fd = srv->fds[srv->handed_out++];
+    send_message(child, new_message_of(MSG_CONNECT, (void*) (intptr_t) fd));
+}
+
+void receive_closed(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    (void) data;
+    server* srv = *stateptr;
+    srv->closed += 1;
+    if(srv->closed == srv->connections){
+        commit_suicide();
+    }
+}
+
+void connect_socket(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    connection* conn = *stateptr;
+    conn->fd = (int) (intptr_t) data;
+    cacti_io_watch(actor_id_self(), conn->fd, CACTI_IO_READABLE, MSG_IO);
+}
+
+// Reads as much as fits in the buffer. Returns false once the client has hung up.
+bool receive(connection* conn){
+    while(conn->pending < ECHO_BUFFER){
+        ssize_t count = read(conn->fd, conn->buffer + conn->pending, ECHO_BUFFER - conn->pending);
+        if(count == 0) return false;
+        if(count < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        conn->pending += count;
+    }
+    return true;
+}
+
+// Writes back as much as the socket takes.
+void flush(connection* conn){
+    size_t written = 0;
+    while(written < conn->pending){
+        ssize_t count = write(conn->fd, conn->buffer + written, conn->pending - written);
+        if(count <= 0) break;
+        written += count;
+    }
+    memmove(conn->buffer, conn->buffer + written, conn->pending - written);
+    conn->pending -= written;
+}
+
+// Every event is followed by a new watch: for more input while there is room for it,
+// and for room in the socket while there is output left.
+void handle_io(void **stateptr, size_t nbytes, void* data){
+    (void) nbytes;
+    connection* conn = *stateptr;
+    cacti_io_event_t* event = data;
+    bool open = true;
+    if(event->events & (CACTI_IO_READABLE | CACTI_IO_CLOSED)) open = receive(conn);
+    if(open) flush(conn);
+    if(!open || (event->events & CACTI_IO_CLOSED)){
+        cacti_io_unwatch(conn->fd);
+        close(conn->fd);
+        send_message(conn->server, new_message_of(MSG_CLOSED, NULL));
+        free(conn);
+        *stateptr = NULL;
+        commit_suicide();
+        return;
+    }
+    int events = (conn->pending < ECHO_BUFFER ? CACTI_IO_READABLE : 0) | (conn->pending > 0 ? CACTI_IO_WRITABLE : 0);
+    cacti_io_watch(actor_id_self(), conn->fd, events, MSG_IO);
+}
+
+// Reads exactly nbytes, or fails.
+bool read_fully(int fd, char* buffer, size_t nbytes){
+    size_t done = 0;
+    while(done < nbytes){
+        ssize_t count = read(fd, buffer + done, nbytes - done);
+        if(count <= 0) return false;
+        done += count;
+    }
+    return true;
+}
+
+// The first actor is the server. In every round the client sends one line over each connection,
+// then reads all the echoes back. Once done, it hangs up, so the connection actors close their
+// sockets and die, and then the server does.
+int main(int argc, char** argv){
+    int connections = argc > 1 ? atoi(argv[1]) : 4;
+    long lines = argc > 2 ? atol(argv[2]) : 1000;
+    if(connections < 1) connections = 1;
+    server srv;
+    srv.fds = malloc(connections * sizeof(int));
+    srv.connections = connections;
+    srv.handed_out = 0;
+    srv.closed = 0;
+    int* clients = malloc(connections * sizeof(int));
+    for(int i = 0; i < connections; i++){
+        int pair[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0){
+            perror("socketpair");
+            return 1;
+        }
+        fcntl(pair[1], F_SETFL, fcntl(pair[1], F_GETFL) | O_NONBLOCK);
+        clients[i] = pair[0];
+        srv.fds[i] = pair[1];
+    }
+    actor_id_t dir;
+    actor_system_create(&dir, new_role());
+    send_message(dir, new_message_of(MSG_SERVE, &srv));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char line[64], echo[64];
+    long errors = 0;
+    for(long i = 0; i < lines; i++){
+        for(int c = 0; c < connections; c++){
+            int length = snprintf(line, sizeof(line), "line %ld of connection %d\n", i, c);
+            if(write(clients[c], line, length) != length) errors += 1;
+        }
+        for(int c = 0; c < connections; c++){
+            int length = snprintf(line, sizeof(line), "line %ld of connection %d\n", i, c);
+            if(!read_fully(clients[c], echo, length) || memcmp(line, echo, length) != 0) errors += 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for(int c = 0; c < connections; c++) close(clients[c]);
+    actor_system_join(dir);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("echoed %ld lines over %d connections in %.3f s, %.0f round trips per second, %ld errors\n",
+           lines * connections, connections, seconds, lines * connections / seconds, errors);
+    free(srv.fds);
+    free(clients);
+    return errors == 0 ? 0 : 1;
+}
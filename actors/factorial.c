@@ -41,14 +41,10 @@ message_t new_spawn_message(){
     return res;
 }
 
-message_t new_hello_response(){
-    message_t res;
-    res.message_type = 2;
-    actor_id_t* ait = malloc(sizeof(actor_id_t));
-    *ait = actor_id_self();
-    res.data = ait;
-    res.nbytes = sizeof(res.data);
-    return res;
+// The id is small enough to be copied into the father's queue.
+void send_hello_response(actor_id_t makers_id){
+    actor_id_t ait = actor_id_self();
+    send_message_inline(makers_id, 2, &ait, sizeof(actor_id_t));
 }
 
 void hello(void **stateptr, size_t nbytes, void* data) {
@@ -56,7 +52,7 @@ void hello(void **stateptr, size_t nbytes, void* data) {
     (void) &nbytes;
     actor_id_t makers_id =  *((actor_id_t* )data);
     free(data);
-    send_message(makers_id, new_hello_response());
+    send_hello_response(makers_id);
 }
 
 message_t new_suicide(){
@@ -97,7 +93,6 @@ void receive_hello_response(void **stateptr, size_t nbytes, void* data){
     message.message_type = 1;
     send_message(sender, message);
     commit_suicide();
-    free(data);
 }
 
 // Each actor, after receiving a message of type 1, creates a new actor, sends it a hello message,
@@ -1,6 +1,5 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 
 #include "cacti.h"
 
@@ -14,6 +13,8 @@
 // | 1  1  12 |
 // |23  3   7 |
 // and the program will wait 4 miliseconds while adding 12 to the value of the first row.
+// The waits are timers, so no thread is held up meanwhile, and the waits of different
+// cells overlap.
 // The expected output, therefore, is:
 // 14
 // 33
@@ -50,8 +51,10 @@ matrix_actor_state* new_actor_state(int my_column_number, actor_id_t father){
     return res;
 }
 
+// The messages are passed down the pipeline from thread to thread, so they come from
+// the system's payload pools rather than from malloc. The receiver frees them.
 matrix_message* new_matrix_message(int pref, int row){
-    matrix_message* res = malloc(sizeof(matrix_message));
+    matrix_message* res = cacti_msg_alloc(sizeof(matrix_message));
     res->prefix = pref;
     res->row_number = row;
     return res;
@@ -63,17 +66,21 @@ void forward_matrix(void **stateptr, size_t nbytes, void* data);
 
 void receive_hello_response(void **stateptr, size_t nbytes, void* data);
 
+void add_cell(void **stateptr, size_t nbytes, void* data);
+
 act_t h = &hello;
 act_t f = &receive_hello_response;
 act_t s = &forward_matrix;
+act_t a = &add_cell;
 
 role_t* new_role(){
     role_t* res = malloc(sizeof(role_t));
-    res->nprompts = 3;
-    void** prompts = malloc(3 * sizeof(act_t));
+    res->nprompts = 4;
+    void** prompts = malloc(4 * sizeof(act_t));
     prompts[0] = h;
     prompts[1] = f;
     prompts[2] = s;
+    prompts[3] = a;
     res->prompts = (act_t*) prompts;
     return res;
 }
@@ -106,8 +113,8 @@ void commit_suicide(){
     send_message(actor_id_self(), new_suicide());
 }
 
-void sleep_mili(int row_no, int col_no){
-    usleep(matrix_data[2*n*row_no+2*col_no+1] * 1000);
+int delay_mili(int row_no, int col_no){
+    return matrix_data[2*n*row_no+2*col_no+1];
 }
 
 int value_row_column(int row_no, int col_no){
@@ -136,18 +143,36 @@ void hello(void **stateptr, size_t nbytes, void* data) {
     }
 }
 
-// Receives a message to calculate the value of a specific row,
-// and sends the same type of message further if necessary
+// Receives a message to calculate the value of a specific row, and has it sent back
+// to the actor once the cell's delay passes.
 void forward_matrix(void **stateptr, size_t nbytes, void* data){
+    matrix_actor_state* state = *((matrix_actor_state**)stateptr);
+    int delay = delay_mili(((matrix_message*) data)->row_number, state->my_column_number-1);
+    if(delay <= 0){
+        add_cell(stateptr, nbytes, data);
+        return;
+    }
+    message_t delayed;
+    delayed.message_type = 3;
+    delayed.data = data;
+    delayed.nbytes = nbytes;
+    // Without a timer the cell is simply added at once.
+    if(send_message_after(actor_id_self(), delayed, delay * 1000L) < 0){
+        add_cell(stateptr, nbytes, data);
+    }
+}
+
+// Adds the cell to the row's value, and sends the same type of message further
+// if necessary.
+void add_cell(void **stateptr, size_t nbytes, void* data){
     (void) nbytes;
     matrix_actor_state* state = *((matrix_actor_state**)stateptr);
     matrix_message received = *((matrix_message*) data);
-    sleep_mili(received.row_number, state->my_column_number-1);
     state->processed_rows_no += 1;
     if(state->my_column_number == n){
         state->obtained_values[received.row_number] += value_row_column(received.row_number, n-1) +
                                                         received.prefix;
-        free(data);
+        cacti_msg_free(data);
         if(state->processed_rows_no == k){
             for(int i = 0; i < k; i++){
                 printf("%d\n", state->obtained_values[i]);
@@ -165,8 +190,9 @@ void forward_matrix(void **stateptr, size_t nbytes, void* data){
         new_message.message_type = 2;
         new_message.data = new_message_data;
         new_message.nbytes = sizeof(matrix_message);
-        free(data);
-        send_message(state->my_column_number+1, new_message);
+        cacti_msg_free(data);
+        // The next column may be behind, then the row waits for room in its queue.
+        if(send_message_wait(state->my_column_number+1, new_message) < 0) cacti_msg_free(new_message_data);
     }
     if(state->processed_rows_no == k){
         free(state);
@@ -179,15 +205,18 @@ void receive_hello_response(void **stateptr, size_t nbytes, void* data){
     (void) nbytes;
     actor_id_t se = actor_id_self();
     if(se == 0){
-        matrix_message* matr_message;
-        message_t message;
+        // The rows are sent at once, as many as fit in the queue, and the rest as it empties.
+        message_t* messages = malloc(k * sizeof(message_t));
         for(int i = 0; i < k; i++){
-            matr_message = new_matrix_message(0, i);
-            message.message_type = 2;
-            message.nbytes = sizeof(matrix_message);
-            message.data = matr_message;
-            send_message(1, message);
+            messages[i].message_type = 2;
+            messages[i].nbytes = sizeof(matrix_message);
+            messages[i].data = new_matrix_message(0, i);
+        }
+        int sent = send_messages(1, messages, k);
+        for(int i = sent < 0 ? 0 : sent; i < k; i++){
+            if(send_message_wait(1, messages[i]) < 0) cacti_msg_free(messages[i].data);
         }
+        free(messages);
     }
     else{
         matrix_actor_state* mas = (matrix_actor_state*) *stateptr;
@@ -200,7 +229,8 @@ void receive_hello_response(void **stateptr, size_t nbytes, void* data){
 // which does not spawn any new actors, and sends a 1 to its 'father'. Upon receiving a 1, every
 // actor sends it back to its respective father - except, again, for the first one, which instead
 // initializes the calculation by sending k messages of type 2 to the actor responsible for the
-// first column. Upon receiving a message of type 2, the actor performs a calculation pertaining
+// first column. Upon receiving a message of type 2, the actor starts a timer for the cell's
+// delay, which sends the message back as type 3. Then the actor performs a calculation pertaining
 // to its column and the row specified in the message and resends the message further. The last
 // actor outputs the obtained sums after having obtained all of them. Each actor commits 'suicide'
 // by sending a GODIE message to itself after it's done with its calculations.